@@ -0,0 +1,425 @@
+/**
+ * Headless loading benchmark.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "resample.h"
+#include "slab.h"
+#include "trace.h"
+
+typedef struct {
+    JCatalog *catalog;
+    int count, w, h, exif;
+    SDL_atomic_t next; // next entry to load
+    SDL_mutex *lock; // guards the totals below
+    JLoadTimes total;
+    double *latency; // ms per image
+    int failed, exifUsed;
+} JBench;
+
+static double toMs(Uint64 ticks) {
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static int benchWorker(void *data) {
+    JBench *bench = (JBench *)data;
+    JPEGRecord *jpeg;
+    JLoadTimes times;
+    JImage *image;
+    JZFile *zip;
+    Uint64 start;
+    int i, exif;
+
+    trace_thread("bench");
+
+    while((i = SDL_AtomicAdd(&bench->next, 1)) < bench->count) {
+        jpeg = catalog_entry(bench->catalog, i);
+        memset(&times, 0, sizeof(times));
+        trace_entry(jpeg, bench->w, bench->h);
+
+        start = SDL_GetPerformanceCounter();
+        image = NULL;
+        exif = 0;
+        if((zip = catalog_open(bench->catalog, jpeg)) != NULL) { // opening is timed too
+            if(bench->exif && bench->w && bench->h)
+                image = loadExifThumbFromZip(zip, jpeg, bench->w, bench->h);
+            if(!(exif = (image != NULL)))
+                image = loadImageTimed(zip, jpeg, bench->w, bench->h, &times);
+            catalog_release(bench->catalog, jpeg);
+        }
+        bench->latency[i] = toMs(SDL_GetPerformanceCounter() - start);
+
+        if(image != NULL)
+            destroy_image(image);
+
+        SDL_LockMutex(bench->lock);
+        if(image == NULL)
+            bench->failed++;
+        bench->exifUsed += exif;
+        bench->total.read += times.read;
+        bench->total.inflate += times.inflate;
+        bench->total.decode += times.decode;
+        bench->total.convert += times.convert;
+        bench->total.scale += times.scale;
+        SDL_UnlockMutex(bench->lock);
+    }
+
+    return 0;
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static double percentile(double *sorted, int count, int p) {
+    return count ? sorted[(count - 1) * p / 100] : 0.0;
+}
+
+static void printJSONString(const char *s) {
+    putchar('"');
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if((unsigned char)*s < 32)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+int run_bench(JCatalog *catalog, int count, JBenchConfig *config) {
+    JBench bench;
+    SDL_Thread **threads;
+    double wall, mb = 0, uncompressedMb = 0, waste;
+    JSlabStats slabs;
+    Uint64 start;
+    int i, started = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.catalog = catalog;
+    bench.count = count;
+    bench.w = config->w;
+    bench.h = config->h;
+    bench.exif = config->exif;
+
+    if(config->threads < 1)
+        config->threads = 1;
+
+    bench.lock = SDL_CreateMutex();
+    bench.latency = (double *)calloc(count + 1, sizeof(double));
+    threads = (SDL_Thread **)calloc(config->threads, sizeof(SDL_Thread *));
+
+    if(bench.lock == NULL || bench.latency == NULL || threads == NULL) {
+        fprintf(stderr, "Couldn't allocate benchmark state!\n");
+        return 1;
+    }
+
+    for(i = 0; i < count; i++) {
+        mb += catalog_entry(catalog, i)->compressedSize / 1048576.0;
+        uncompressedMb += catalog_entry(catalog, i)->size / 1048576.0;
+    }
+
+    start = SDL_GetPerformanceCounter();
+
+    for(i = 0; i < config->threads; i++)
+        if((threads[i] = SDL_CreateThread(benchWorker, "bench", &bench)) != NULL)
+            started++;
+
+    if(!started) // do it ourselves then
+        benchWorker(&bench);
+
+    for(i = 0; i < config->threads; i++)
+        if(threads[i] != NULL)
+            SDL_WaitThread(threads[i], NULL);
+
+    wall = toMs(SDL_GetPerformanceCounter() - start);
+
+    qsort(bench.latency, count, sizeof(double), compareDouble);
+
+    slab_stats(&slabs);
+    waste = slabs.slotBytes ? 100.0 * (slabs.slotBytes - slabs.imageBytes) / slabs.slotBytes : 0.0;
+
+    if(config->json) {
+        printf("{\"archive\": ");
+        printJSONString(config->archive);
+        printf(", \"archives\": %d", config->archives);
+        printf(", \"images\": %d, \"failed\": %d, \"width\": %d, \"height\": %d, \"threads\": %d,"
+                " \"exif_thumbnails\": %d,\n",
+                count, bench.failed, config->w, config->h, config->threads, bench.exifUsed);
+        printf(" \"index_ms\": %.3f, \"index_bytes_per_entry\": %.1f, \"index_sidecar\": %s,\n",
+                config->indexTime, count ? (double)config->indexBytes / count : 0.0,
+                config->indexMapped ? "true" : "false");
+        printf(" \"wall_ms\": %.3f, \"images_per_s\": %.3f,"
+                " \"mb_per_s\": %.3f, \"uncompressed_mb_per_s\": %.3f,\n",
+                wall, count * 1000.0 / wall,
+                mb * 1000.0 / wall, uncompressedMb * 1000.0 / wall);
+        printf(" \"latency_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+                percentile(bench.latency, count, 50), percentile(bench.latency, count, 99),
+                percentile(bench.latency, count, 100));
+        printf(" \"stages_ms\": {\"read\": %.3f, \"inflate\": %.3f, \"decode\": %.3f,"
+                " \"convert\": %.3f, \"scale\": %.3f},\n",
+                toMs(bench.total.read), toMs(bench.total.inflate), toMs(bench.total.decode),
+                toMs(bench.total.convert), toMs(bench.total.scale));
+        printf(" \"allocs\": {\"slab\": %d, \"malloc\": %d, \"scratch\": %d,"
+                " \"peak_slab_mb\": %.3f, \"slot_waste_pct\": %.1f, \"peak_scratch_mb\": %.3f}}\n",
+                slabs.slabImages, slabs.mallocImages, slabs.scratchImages,
+                slabs.peakSlabBytes / 1048576.0, waste, slabs.peakScratchBytes / 1048576.0);
+    } else {
+        printf("%s%s: %d images (%d failed), target %dx%d, %d threads\n", config->archive,
+                config->archives > 1 ? " etc." : "", count, bench.failed,
+                config->w, config->h, config->threads);
+        if(config->exif)
+            printf("EXIF:       %d thumbnails used\n", bench.exifUsed);
+        printf("Index:      %9.1f ms, %.1f bytes/entry%s\n", config->indexTime,
+                count ? (double)config->indexBytes / count : 0.0,
+                config->indexMapped ? " (sidecar)" : "");
+        printf("Wall time:  %9.1f ms, %.1f images/s, %.1f MB/s (%.1f MB/s uncompressed)\n",
+                wall, count * 1000.0 / wall, mb * 1000.0 / wall, uncompressedMb * 1000.0 / wall);
+        printf("Latency:    p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                percentile(bench.latency, count, 50), percentile(bench.latency, count, 99),
+                percentile(bench.latency, count, 100));
+        printf("Stages (ms summed over threads):\n");
+        printf("  read      %9.1f\n", toMs(bench.total.read));
+        printf("  inflate   %9.1f\n", toMs(bench.total.inflate));
+        printf("  decode    %9.1f\n", toMs(bench.total.decode));
+        printf("  convert   %9.1f\n", toMs(bench.total.convert));
+        printf("  scale     %9.1f\n", toMs(bench.total.scale));
+        printf("Images:     %d in slabs, %d malloc'd, %d scratch decodes\n",
+                slabs.slabImages, slabs.mallocImages, slabs.scratchImages);
+        printf("Slabs:      %.1f MB peak, %.1f%% of slot space unused\n",
+                slabs.peakSlabBytes / 1048576.0, waste);
+        printf("Scratch:    %.1f MB peak over all threads\n", slabs.peakScratchBytes / 1048576.0);
+    }
+
+    free(threads);
+    free(bench.latency);
+    SDL_DestroyMutex(bench.lock);
+
+    return bench.failed ? 2 : 0;
+}
+
+typedef struct {
+    const char *name;
+    int sw, sh, dw, dh;
+} JScaleCase;
+
+static JImage *testImage(int w, int h) {
+    JImage *image = create_image(w, h);
+    Uint32 seed = 12345;
+    int x, y;
+
+    if(image == NULL)
+        return NULL;
+
+    for(y = 0; y < h; y++) {
+        for(x = 0; x < w; x++) { // gradients plus noise, so no kernel gets lucky
+            seed = seed * 1103515245 + 12345;
+            SETPIXEL(image, x, y, GETRGB((x * 255 / w) ^ ((seed >> 16) & 15),
+                        (y * 255 / h), ((x + y) & 255) ^ ((seed >> 24) & 31)));
+        }
+    }
+
+    return image;
+}
+
+int run_scale_bench(int json) {
+    static const JScaleCase cases[] = {
+        { "24mp_to_1080p", 6000, 4000, 1620, 1080 },
+        { "24mp_to_thumb", 6000, 4000, 400, 266 },
+        { "thumb_decode_to_cell", 750, 500, 400, 266 },
+        { "upscale_preview", 480, 320, 1620, 1080 }
+    };
+    JImage *src, *ref, *res;
+    Uint64 start, best;
+    int c, k, rep, kernels, exact, failed = 0;
+
+    kernels = resample_set_kernel(RESAMPLE_KERNELS - 1) + 1;
+
+    if(json)
+        printf("[");
+
+    for(c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+        if((src = testImage(cases[c].sw, cases[c].sh)) == NULL) {
+            fprintf(stderr, "Couldn't allocate test image!\n");
+            return 1;
+        }
+
+        resample_set_kernel(RESAMPLE_SCALAR);
+        ref = resample_image(src, cases[c].dw, cases[c].dh);
+
+        for(k = 0; k < kernels; k++) {
+            resample_set_kernel(k);
+            res = NULL;
+            best = 0;
+
+            for(rep = 0; rep < 3; rep++) { // best of three
+                if(res != NULL)
+                    destroy_image(res);
+                start = SDL_GetPerformanceCounter();
+                res = resample_image(src, cases[c].dw, cases[c].dh);
+                start = SDL_GetPerformanceCounter() - start;
+                if(!rep || start < best)
+                    best = start;
+            }
+
+            exact = ref != NULL && res != NULL && !memcmp(ref->data, res->data,
+                    sizeof(Uint32) * res->w * res->h);
+            failed += !exact;
+
+            if(json)
+                printf("%s{\"case\": \"%s\", \"kernel\": \"%s\", \"ms\": %.3f,"
+                        " \"source_mpix_per_s\": %.1f, \"bit_exact\": %s}",
+                        (c || k) ? ",\n " : "", cases[c].name, resample_kernel_name(k),
+                        toMs(best), cases[c].sw * (double)cases[c].sh / 1000.0 / toMs(best),
+                        exact ? "true" : "false");
+            else
+                printf("%-22s %-7s %8.2f ms %8.1f MP/s %s\n", cases[c].name,
+                        resample_kernel_name(k), toMs(best),
+                        cases[c].sw * (double)cases[c].sh / 1000.0 / toMs(best),
+                        exact ? "" : "MISMATCH");
+
+            if(res != NULL)
+                destroy_image(res);
+        }
+
+        if(ref != NULL)
+            destroy_image(ref);
+        destroy_image(src);
+    }
+
+    if(json)
+        printf("]\n");
+
+    resample_set_kernel(RESAMPLE_KERNELS - 1); // back to best available
+
+    return failed ? 2 : 0;
+}
+
+enum { OP_FILL, OP_BLIT, OP_BLEND, OP_GREYSCALE, OP_INVERT, OP_ROTATE, OPS };
+
+static const char *opNames[OPS] = { "fill", "blit", "blend", "greyscale", "invert", "rotate" };
+static const int opBytes[OPS] = { 4, 8, 12, 8, 8, 8 }; // read and written per pixel
+
+// Destination is reset from src before each run, that isn't timed
+static Uint64 timeOp(int op, JImage *dest, JImage *src) {
+    Uint64 start;
+
+    dest->w = src->w; // rotation turns it
+    dest->h = src->h;
+    copy_image(dest, src);
+    start = SDL_GetPerformanceCounter();
+
+    switch(op) {
+    case OP_FILL:
+        fill_image(dest, 0x123456);
+        break;
+    case OP_BLIT:
+        blit_sprite(dest, 0, 0, src);
+        break;
+    case OP_BLEND: // low bytes of src cover all alphas, 0 and 255 included
+        blit_font(dest, src, 0, 0, 0xFFC040);
+        break;
+    case OP_GREYSCALE:
+        greyscale_image(dest);
+        break;
+    case OP_INVERT:
+        invert_image(dest);
+        break;
+    case OP_ROTATE: // portrait camera shot, the usual case
+        orient_image(dest, src, 6);
+        break;
+    }
+
+    return SDL_GetPerformanceCounter() - start;
+}
+
+int run_image_bench(int json) {
+    static const JScaleCase sizes[] = {
+        { "1080p", 1920, 1080, 0, 0 },
+        { "4k", 3840, 2160, 0, 0 }
+    };
+    JImage *src, *ref, *res;
+    Uint64 t, best;
+    double gbps;
+    int s, op, k, rep, exact, first = 1, failed = 0;
+
+    if(json)
+        printf("[");
+
+    for(s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        src = testImage(sizes[s].sw, sizes[s].sh);
+        ref = create_image(sizes[s].sw, sizes[s].sh);
+        res = create_image(sizes[s].sw, sizes[s].sh);
+
+        if(src == NULL || ref == NULL || res == NULL) {
+            fprintf(stderr, "Couldn't allocate test image!\n");
+            return 1;
+        }
+
+        for(op = 0; op < OPS; op++) {
+            image_set_kernel(IMAGE_SCALAR);
+            timeOp(op, ref, src);
+
+            for(k = 0; k < IMAGE_KERNELS; k++) {
+                if(image_set_kernel(k) != k)
+                    continue; // not on this CPU
+                if(k && (op == OP_FILL || op == OP_BLIT))
+                    break; // memset and memcpy whatever the kernel
+
+                for(rep = 0, best = 0; rep < 5; rep++) { // best of five
+                    t = timeOp(op, res, src);
+                    if(!rep || t < best)
+                        best = t;
+                }
+
+                exact = !memcmp(ref->data, res->data, sizeof(Uint32) * res->w * res->h);
+                failed += !exact;
+                gbps = (double)opBytes[op] * res->w * res->h / 1e6 / toMs(best);
+
+                if(json)
+                    printf("%s{\"op\": \"%s\", \"size\": \"%s\", \"kernel\": \"%s\", \"ms\": %.3f,"
+                            " \"gb_per_s\": %.2f, \"bit_exact\": %s}",
+                            first ? "" : ",\n ", opNames[op], sizes[s].name, image_kernel_name(k),
+                            toMs(best), gbps, exact ? "true" : "false");
+                else
+                    printf("%-10s %-6s %-7s %8.3f ms %7.2f GB/s %s\n", opNames[op], sizes[s].name,
+                            image_kernel_name(k), toMs(best), gbps, exact ? "" : "MISMATCH");
+                first = 0;
+            }
+        }
+
+        destroy_image(res);
+        destroy_image(ref);
+        destroy_image(src);
+    }
+
+    if(json)
+        printf("]\n");
+
+    image_set_kernel(IMAGE_KERNELS - 1); // back to best available
+
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Headless loading benchmark.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include "SDL2/SDL.h"
+
+#include "catalog.h"
+#include "loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct {
+    const char *archive; // for the report, first of them
+    int archives; // in the catalogue
+    int w, h; // target size, 0x0 for full size
+    int threads;
+    int json; // machine readable output
+    int exif; // try EXIF thumbnails first like the thumbnail grid
+    double indexTime; // ms spent in processZip
+    size_t indexBytes; // memory used by the index
+    int indexMapped; // index came from sidecar file
+} JBenchConfig;
+
+// Load every entry through loadImageTimed (after loadExifThumbFromZip if
+// config->exif) and print statistics to stdout. Catalogue must be fully
+// indexed.
+int run_bench(JCatalog *catalog, int count, JBenchConfig *config);
+
+// Time resample kernels on synthetic images and check they match scalar
+int run_scale_bench(int json);
+
+// Time image.c primitives at 1080p and 4K in GB/s for each kernel set,
+// checking they match scalar
+int run_image_bench(int json);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * Several archives, or directories of them, as one list of entries.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "catalog.h"
+#include "mapfile.h"
+
+static int addArchive(JCatalog *catalog, const char *path) {
+    JArchive *grown;
+
+    if(catalog->count >= CATALOG_MAX_ARCHIVES)
+        return 0;
+
+    if(!(catalog->count & (catalog->count - 1))) { // at powers of two
+        if((grown = (JArchive *)realloc(catalog->archives,
+                        (catalog->count ? catalog->count * 2 : 1) * sizeof(JArchive))) == NULL)
+            return 0;
+        catalog->archives = grown;
+    }
+
+    memset(&catalog->archives[catalog->count], 0, sizeof(JArchive));
+    if((catalog->archives[catalog->count].path = strdup(path)) == NULL)
+        return 0;
+    catalog->count++;
+
+    return 1;
+}
+
+static int isZip(const char *name) {
+    size_t len = strlen(name);
+
+    return len > 4 && name[len - 4] == '.' && tolower(name[len - 3]) == 'z' &&
+        tolower(name[len - 2]) == 'i' && tolower(name[len - 1]) == 'p';
+}
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+// ZIPs directly in dir, sorted so the order is the same every time
+static void addDirectory(JCatalog *catalog, const char *dir) {
+    char **names = NULL, **grown, path[2048];
+    const char *slash = (*dir && strchr("/\\", dir[strlen(dir) - 1])) ? "" : "/";
+    int count = 0, max = 0, i;
+    struct dirent *de;
+    DIR *d;
+
+    if((d = opendir(dir)) == NULL)
+        return;
+
+    while((de = readdir(d)) != NULL) {
+        if(!isZip(de->d_name))
+            continue;
+
+        if(count == max) {
+            if((grown = (char **)realloc(names, (max = max ? max * 2 : 64) * sizeof(char *))) == NULL)
+                break;
+            names = grown;
+        }
+
+        if((names[count] = strdup(de->d_name)) != NULL)
+            count++;
+    }
+    closedir(d);
+
+    qsort(names, count, sizeof(char *), compareNames);
+
+    for(i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s%s%s", dir, slash, names[i]);
+        addArchive(catalog, path);
+        free(names[i]);
+    }
+
+    free(names);
+}
+
+static void linkNewest(JCatalog *catalog, JArchive *archive) {
+    archive->older = catalog->newest;
+    archive->newer = NULL;
+
+    if(catalog->newest) catalog->newest->newer = archive;
+    else catalog->oldest = archive;
+
+    catalog->newest = archive;
+    catalog->idle++;
+}
+
+static void unlinkIdle(JCatalog *catalog, JArchive *archive) {
+    if(archive->newer) archive->newer->older = archive->older;
+    else catalog->newest = archive->older;
+
+    if(archive->older) archive->older->newer = archive->newer;
+    else catalog->oldest = archive->newer;
+
+    archive->newer = archive->older = NULL;
+    catalog->idle--;
+}
+
+// Close least recently used idle handles until at most limit are idle.
+// Call with catalog lock held.
+static void closeIdle(JCatalog *catalog, int limit) {
+    JArchive *archive;
+
+    while(catalog->idle > limit) {
+        archive = catalog->oldest;
+        unlinkIdle(catalog, archive);
+        archive->zip->close(archive->zip);
+        archive->zip = NULL;
+    }
+}
+
+static JZFile *acquire(JCatalog *catalog, JArchive *archive) {
+    JZFile *zip;
+
+    SDL_LockMutex(catalog->lock);
+
+    if(archive->zip == NULL) {
+        closeIdle(catalog, CATALOG_HANDLES - 1); // room for this one
+        archive->zip = jzfile_open(archive->path);
+    } else if(!archive->refs)
+        unlinkIdle(catalog, archive);
+
+    if((zip = archive->zip) != NULL)
+        archive->refs++;
+
+    SDL_UnlockMutex(catalog->lock);
+
+    return zip;
+}
+
+static void release(JCatalog *catalog, JArchive *archive) {
+    SDL_LockMutex(catalog->lock);
+    if(--archive->refs == 0)
+        linkNewest(catalog, archive);
+    SDL_UnlockMutex(catalog->lock);
+}
+
+// Returns zero if archive can't be indexed, it's skipped then
+static int startIndex(JCatalog *catalog, int id) {
+    JArchive *archive = &catalog->archives[id];
+    JZFile *zip;
+
+    archive->first = catalog->entries;
+
+    if((zip = acquire(catalog, archive)) == NULL)
+        return 0;
+
+    archive->index = create_zipindex(zip, archive->path, id, catalog->options, catalog->filter);
+    release(catalog, archive);
+
+    return archive->index != NULL;
+}
+
+JCatalog *create_catalog(char **paths, int count, int options,
+        int (*filter)(const char *filename), long long thumbLimit) {
+    JCatalog *catalog = (JCatalog *)calloc(1, sizeof(JCatalog));
+    struct stat st;
+    int i;
+
+    if(catalog == NULL)
+        return NULL;
+
+    catalog->options = options;
+    catalog->filter = filter;
+    catalog->thumbLimit = thumbLimit;
+
+    if((catalog->lock = SDL_CreateMutex()) == NULL) {
+        destroy_catalog(catalog);
+        return NULL;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(!stat(paths[i], &st) && S_ISDIR(st.st_mode))
+            addDirectory(catalog, paths[i]);
+        else
+            addArchive(catalog, paths[i]);
+    }
+
+    // All of them unless indexing in background. Then the budget may run
+    // out on broken or slow ones first, so go on until one has an index.
+    for(i = 0; ; ) {
+        catalog_update(catalog);
+
+        for(; i < catalog->indexed && catalog->archives[i].index == NULL; i++)
+            ;
+
+        if(i < catalog->count && catalog->archives[i].index != NULL)
+            break;
+
+        if(catalog->indexed == catalog->count) { // none could be indexed
+            destroy_catalog(catalog);
+            return NULL;
+        }
+    }
+
+    return catalog;
+}
+
+void destroy_catalog(JCatalog *catalog) {
+    JArchive *archive;
+    int i;
+
+    for(i = 0; i < catalog->count; i++) {
+        archive = &catalog->archives[i];
+        if(archive->index != NULL)
+            destroy_zipindex(archive->index);
+        if(archive->thumbs != NULL)
+            destroy_thumbcache(archive->thumbs);
+        if(archive->zip != NULL)
+            archive->zip->close(archive->zip);
+        free(archive->path);
+    }
+
+    if(catalog->lock != NULL)
+        SDL_DestroyMutex(catalog->lock);
+    free(catalog->archives);
+    free(catalog);
+}
+
+int catalog_update(JCatalog *catalog) {
+    Uint32 start = SDL_GetTicks();
+    JArchive *archive;
+    int done;
+
+    for(; catalog->indexed < catalog->count; catalog->indexed++) {
+        // Thousands of small archives take a while even if each is quick
+        if((catalog->options & ZIPINDEX_BACKGROUND) && SDL_GetTicks() - start > CATALOG_BUDGET)
+            break;
+
+        archive = &catalog->archives[catalog->indexed];
+
+        if(archive->index == NULL && !startIndex(catalog, catalog->indexed))
+            continue; // skip broken ones
+
+        done = zipindex_done(archive->index); // before count, so none are missed
+        archive->count = zipindex_count(archive->index);
+        catalog->entries = archive->first + archive->count;
+
+        if(!done)
+            break;
+    }
+
+    return catalog->entries;
+}
+
+JPEGRecord *catalog_entry(JCatalog *catalog, int index) {
+    int lo = 0, hi = MIN(catalog->indexed, catalog->count - 1), mid;
+    JArchive *archive;
+
+    // Budget may have run out before the next archive was started, its
+    // first isn't set yet
+    if(hi > 0 && catalog->archives[hi].index == NULL)
+        hi--;
+
+    // Last archive starting at or before index, empty ones start where
+    // the next one does
+    while(lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if(catalog->archives[mid].first <= index)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    while(lo > 0 && catalog->archives[lo].index == NULL) // broken ones have no entries
+        lo--;
+
+    archive = &catalog->archives[lo];
+
+    return &archive->index->jpegs[index - archive->first];
+}
+
+JZFile *catalog_open(JCatalog *catalog, JPEGRecord *jpeg) {
+    return acquire(catalog, &catalog->archives[jpeg->archive]);
+}
+
+void catalog_release(JCatalog *catalog, JPEGRecord *jpeg) {
+    release(catalog, &catalog->archives[jpeg->archive]);
+}
+
+JThumbCache *catalog_thumbs(JCatalog *catalog, JPEGRecord *jpeg) {
+    JArchive *archive = &catalog->archives[jpeg->archive];
+    JThumbCache *thumbs, *created;
+    int tried;
+
+    SDL_LockMutex(catalog->lock);
+    tried = archive->thumbsTried;
+    thumbs = archive->thumbs;
+    SDL_UnlockMutex(catalog->lock);
+
+    if(tried)
+        return thumbs;
+
+    // Opening and mapping the file takes a while, others keep loading
+    created = create_thumbcache(archive->path, catalog->thumbLimit);
+
+    SDL_LockMutex(catalog->lock);
+    if(!archive->thumbsTried) {
+        archive->thumbsTried = 1;
+        archive->thumbs = created;
+        created = NULL;
+    }
+    thumbs = archive->thumbs;
+    SDL_UnlockMutex(catalog->lock);
+
+    if(created != NULL) // another thread was faster
+        destroy_thumbcache(created);
+
+    return thumbs;
+}
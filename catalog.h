@@ -0,0 +1,110 @@
+/**
+ * Several archives, or directories of them, as one list of entries.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __CATALOG_H
+#define __CATALOG_H
+
+#include "SDL2/SDL.h"
+
+#include "junzip.h"
+#include "loader.h"
+#include "thumbcache.h"
+#include "zipindex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Each archive has its own JZipIndex and thumbnail cache, and entry i of
+ * the catalogue is found from the running count of entries before each
+ * archive. Archives are indexed one after another, so only the last one
+ * grows and entries never change place.
+ *
+ * Archives are opened when something is loaded from them and the handle
+ * is kept until CATALOG_HANDLES others are open and idle. That way
+ * thousands of archives don't run out of file descriptors or address
+ * space, and scrolling within one archive doesn't reopen it.
+ */
+
+#define CATALOG_HANDLES 64 // open archives nobody is using at most
+#define CATALOG_BUDGET 10 // ms of indexing per catalog_update() in background
+#define CATALOG_MAX_ARCHIVES 65536 // JPEGRecord.archive is 16 bits
+
+typedef struct JArchive {
+    char *path;
+    JZipIndex *index; // NULL until indexed, or if it couldn't be
+    int first; // catalogue index of first entry
+    int count; // entries so far
+
+    JZFile *zip; // NULL when closed
+    int refs; // catalog_open() calls not released yet
+    struct JArchive *newer, *older; // idle handles in LRU order
+
+    JThumbCache *thumbs; // created when first needed
+    int thumbsTried;
+} JArchive;
+
+typedef struct {
+    JArchive *archives;
+    int count;
+    int indexed; // archives before this are done
+    int entries; // in all archives so far
+
+    int options; // ZIPINDEX_ options
+    int (*filter)(const char *filename);
+    long long thumbLimit; // disk cache size, 0 for none
+
+    SDL_mutex *lock; // for handles and thumbnail caches
+    JArchive *newest, *oldest; // idle handles
+    int idle;
+} JCatalog;
+
+// Paths are archives or directories, whose .zip files are added in name
+// order. Options are for create_zipindex(). Returns NULL if none of the
+// archives could be indexed.
+JCatalog *create_catalog(char **paths, int count, int options,
+        int (*filter)(const char *filename), long long thumbLimit);
+
+// Stops indexing, closes archives and writes thumbnail caches
+void destroy_catalog(JCatalog *catalog);
+
+// Moves indexing along, returns entries so far. Call from main thread.
+int catalog_update(JCatalog *catalog);
+
+// Entry at index < catalog_update(). Main thread only, or any thread once
+// indexing is done.
+JPEGRecord *catalog_entry(JCatalog *catalog, int index);
+
+// Handle to entry's archive, NULL if it can't be opened. Thread safe,
+// give it back with catalog_release() when done.
+JZFile *catalog_open(JCatalog *catalog, JPEGRecord *jpeg);
+
+void catalog_release(JCatalog *catalog, JPEGRecord *jpeg);
+
+// Thumbnail cache of entry's archive, NULL if disabled. Thread safe.
+JThumbCache *catalog_thumbs(JCatalog *catalog, JPEGRecord *jpeg);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
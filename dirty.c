@@ -0,0 +1,116 @@
+/**
+ * Dirty rectangle tracking for partial screen texture updates.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dirty.h"
+
+void dirty_clear(JDirty *dirty) {
+    dirty->count = 0;
+}
+
+// Union of a and b, if it covers nothing more than they do
+static int mergeRect(SDL_Rect *a, const SDL_Rect *b) {
+    if(a->y == b->y && a->h == b->h && b->x <= a->x + a->w && a->x <= b->x + b->w) {
+        a->w = MAX(a->x + a->w, b->x + b->w) - MIN(a->x, b->x);
+        a->x = MIN(a->x, b->x);
+        return 1;
+    }
+
+    if(a->x == b->x && a->w == b->w && b->y <= a->y + a->h && a->y <= b->y + b->h) {
+        a->h = MAX(a->y + a->h, b->y + b->h) - MIN(a->y, b->y);
+        a->y = MIN(a->y, b->y);
+        return 1;
+    }
+
+    // Contained in a already
+    return b->x >= a->x && b->y >= a->y &&
+        b->x + b->w <= a->x + a->w && b->y + b->h <= a->y + a->h;
+}
+
+void dirty_add(JDirty *dirty, int x, int y, int w, int h) {
+    SDL_Rect rect;
+    int i, x1, y1;
+
+    if(w <= 0 || h <= 0)
+        return;
+
+    rect.x = x;
+    rect.y = y;
+    rect.w = w;
+    rect.h = h;
+
+    for(i = 0; i < dirty->count; i++)
+        if(mergeRect(&dirty->rects[i], &rect))
+            return;
+
+    if(dirty->count < DIRTY_MAX) {
+        dirty->rects[dirty->count++] = rect;
+        return;
+    }
+
+    // Out of room, one box around everything
+    x1 = x + w;
+    y1 = y + h;
+    for(i = 0; i < dirty->count; i++) {
+        x = MIN(x, dirty->rects[i].x);
+        y = MIN(y, dirty->rects[i].y);
+        x1 = MAX(x1, dirty->rects[i].x + dirty->rects[i].w);
+        y1 = MAX(y1, dirty->rects[i].y + dirty->rects[i].h);
+    }
+
+    dirty->count = 1;
+    dirty->rects[0].x = x;
+    dirty->rects[0].y = y;
+    dirty->rects[0].w = x1 - x;
+    dirty->rects[0].h = y1 - y;
+}
+
+void dirty_all(JDirty *dirty, JImage *screen) {
+    dirty->count = 1;
+    dirty->rects[0].x = dirty->rects[0].y = 0;
+    dirty->rects[0].w = screen->w;
+    dirty->rects[0].h = screen->h;
+}
+
+int dirty_upload(JDirty *dirty, SDL_Texture *texture, JImage *screen) {
+    SDL_Rect *rect;
+    int i, n = dirty->count;
+
+    for(i = 0; i < n; i++) {
+        rect = &dirty->rects[i];
+
+        // Clip to screen, callers don't bother
+        if(rect->x < 0) { rect->w += rect->x; rect->x = 0; }
+        if(rect->y < 0) { rect->h += rect->y; rect->y = 0; }
+        rect->w = MIN(rect->w, screen->w - rect->x);
+        rect->h = MIN(rect->h, screen->h - rect->y);
+
+        if(rect->w > 0 && rect->h > 0)
+            SDL_UpdateTexture(texture, rect, &GETPIXEL(screen, rect->x, rect->y),
+                    screen->w * sizeof(Uint32));
+    }
+
+    dirty->count = 0;
+
+    return n;
+}
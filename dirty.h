@@ -0,0 +1,62 @@
+/**
+ * Dirty rectangle tracking for partial screen texture updates.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __DIRTY_H
+#define __DIRTY_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Screen areas changed since the last texture upload. Rectangles next to
+ * each other in a row or column are merged, so a row of grid cells becomes
+ * one upload. If DIRTY_MAX is not enough, everything collapses into one
+ * bounding box, which is still no worse than uploading the whole screen.
+ */
+
+#define DIRTY_MAX 32
+
+typedef struct {
+    SDL_Rect rects[DIRTY_MAX];
+    int count;
+} JDirty;
+
+// Forget all changes, e.g. after a full upload
+void dirty_clear(JDirty *dirty);
+
+void dirty_add(JDirty *dirty, int x, int y, int w, int h);
+
+// Whole screen changed
+void dirty_all(JDirty *dirty, JImage *screen);
+
+// Upload changed areas of screen to texture and clear, returns rects sent
+int dirty_upload(JDirty *dirty, SDL_Texture *texture, JImage *screen);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
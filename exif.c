@@ -0,0 +1,181 @@
+/**
+ * EXIF metadata parsing from the start of a JPEG file.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "exif.h"
+
+#define TAG_COMPRESSION 0x0103
+#define TAG_ORIENTATION 0x0112
+#define TAG_THUMB_OFFSET 0x0201
+#define TAG_THUMB_LENGTH 0x0202
+
+// TIFF data is in either byte order, motorola says which
+static unsigned int get16(const unsigned char *p, int motorola) {
+    return motorola ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static unsigned long get32(const unsigned char *p, int motorola) {
+    return motorola ?
+        ((unsigned long)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) :
+        ((unsigned long)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0]);
+}
+
+// IFD entry value as integer, only SHORT and LONG types are used here
+static unsigned long entryValue(const unsigned char *entry, int motorola) {
+    return get16(entry + 2, motorola) == 3 ? get16(entry + 8, motorola) : get32(entry + 8, motorola);
+}
+
+// Find APP1 segment with EXIF data and its TIFF header, returns like above
+static long findExif(const unsigned char *data, long size, long *tiffStart, long *tiffSize) {
+    long pos = 2, len;
+
+    if(size < 2 || data[0] != 0xFF || data[1] != 0xD8)
+        return -1; // not a JPEG
+
+    for(;;) {
+        if(pos + 4 > size)
+            return pos + 4;
+        if(data[pos] != 0xFF || data[pos + 1] < 0xE0 || data[pos + 1] == 0xFF)
+            return -1; // EXIF is among the first APPn segments, if anywhere
+
+        len = data[pos + 2] << 8 | data[pos + 3];
+        if(len < 2)
+            return -1;
+
+        if(data[pos + 1] == 0xE1) {
+            if(pos + 2 + len > size)
+                return pos + 2 + len;
+            if(len >= 16 && memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+                *tiffStart = pos + 10;
+                *tiffSize = len - 8;
+                return 0;
+            }
+        }
+
+        pos += 2 + len;
+    }
+}
+
+long exif_thumbnail(const unsigned char *data, long size, long *offset, long *length) {
+    const unsigned char *tiff, *entry;
+    unsigned long ifd, thumbOffset = 0, thumbLength = 0;
+    long found, tiffStart, tiffSize;
+    int motorola, count, i, jpeg = 1;
+
+    if((found = findExif(data, size, &tiffStart, &tiffSize)) != 0)
+        return found;
+
+    tiff = data + tiffStart;
+    motorola = (tiff[0] == 'M');
+
+    if((tiff[0] != 'I' && tiff[0] != 'M') || tiff[1] != tiff[0] || get16(tiff + 2, motorola) != 42)
+        return -1;
+
+    // IFD0 is the main image, the thumbnail is described by the next one.
+    // Offsets are compared to the space left, sums could wrap in 32 bits.
+    ifd = get32(tiff + 4, motorola);
+    if(ifd > (unsigned long)tiffSize - 2)
+        return -1;
+    count = get16(tiff + ifd, motorola);
+    if((unsigned long)count * 12 + 4 > (unsigned long)tiffSize - 2 - ifd)
+        return -1;
+
+    ifd = get32(tiff + ifd + 2 + count * 12, motorola);
+    if(ifd == 0 || ifd > (unsigned long)tiffSize - 2)
+        return -1;
+    count = get16(tiff + ifd, motorola);
+    if((unsigned long)count * 12 > (unsigned long)tiffSize - 2 - ifd)
+        return -1;
+
+    for(i = 0; i < count; i++) {
+        entry = tiff + ifd + 2 + i * 12;
+        switch(get16(entry, motorola)) {
+            case TAG_COMPRESSION:
+                jpeg = (entryValue(entry, motorola) == 6);
+                break;
+            case TAG_THUMB_OFFSET:
+                thumbOffset = entryValue(entry, motorola);
+                break;
+            case TAG_THUMB_LENGTH:
+                thumbLength = entryValue(entry, motorola);
+                break;
+        }
+    }
+
+    if(!jpeg || !thumbOffset || !thumbLength || thumbOffset > (unsigned long)tiffSize ||
+            thumbLength > (unsigned long)tiffSize - thumbOffset)
+        return -1; // uncompressed thumbnails are rare, not worth supporting // uncompressed thumbnails are rare, not worth supporting
+
+    *offset = tiffStart + thumbOffset;
+    *length = thumbLength;
+
+    return 0;
+}
+
+// Orientation tag of IFD0, 1 if missing or invalid
+static int tiffOrientation(const unsigned char *tiff, long tiffSize) {
+    const unsigned char *entry;
+    unsigned long ifd, value;
+    int motorola, count, i;
+
+    if(tiffSize < 8)
+        return 1;
+
+    motorola = (tiff[0] == 'M');
+
+    if((tiff[0] != 'I' && tiff[0] != 'M') || tiff[1] != tiff[0] || get16(tiff + 2, motorola) != 42)
+        return 1;
+
+    ifd = get32(tiff + 4, motorola); // see exif_thumbnail() about the checks
+    if(ifd > (unsigned long)tiffSize - 2)
+        return 1;
+    count = get16(tiff + ifd, motorola);
+    if((unsigned long)count * 12 > (unsigned long)tiffSize - 2 - ifd)
+        return 1;
+
+    for(i = 0; i < count; i++) {
+        entry = tiff + ifd + 2 + i * 12;
+        if(get16(entry, motorola) == TAG_ORIENTATION) {
+            value = entryValue(entry, motorola);
+            return (value >= 1 && value <= 8) ? (int)value : 1;
+        }
+    }
+
+    return 1;
+}
+
+int exif_orientation(const unsigned char *data, long size) {
+    long tiffStart, tiffSize;
+
+    if(findExif(data, size, &tiffStart, &tiffSize) != 0)
+        return 1;
+
+    return tiffOrientation(data + tiffStart, tiffSize);
+}
+
+int exif_orientation_app1(const unsigned char *app1, long size) {
+    if(size < 14 || memcmp(app1, "Exif\0\0", 6) != 0)
+        return 1;
+
+    return tiffOrientation(app1 + 6, size - 6);
+}
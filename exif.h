@@ -0,0 +1,46 @@
+/**
+ * EXIF metadata parsing from the start of a JPEG file.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __EXIF_H
+#define __EXIF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// Find the JPEG thumbnail embedded in EXIF (IFD1) of a JPEG file, given
+// its first size bytes. Returns 0 and sets *offset and *length (in bytes
+// from the start of the file) if found, -1 if there is none, or a
+// larger size that is needed to tell.
+long exif_thumbnail(const unsigned char *data, long size, long *offset, long *length);
+
+// EXIF orientation 1-8 of a JPEG file given its first size bytes, 1 (as
+// is) if there is none or it's not within size
+int exif_orientation(const unsigned char *data, long size);
+
+// Same from the contents of an APP1 segment, starting with "Exif"
+int exif_orientation_app1(const unsigned char *app1, long size);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -32,6 +32,7 @@ JImage *make_letter(JImage *font, int x, int y, int w, int h, void ** mempool) {
 
     image->w = w;
     image->h = h;
+    image->slab = NULL;
     image->data = (Uint32 *)(*mempool);
     *mempool += w*h * sizeof(Uint32);
 
@@ -0,0 +1,179 @@
+/**
+ * On-screen performance overlay.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hud.h"
+
+#define HUD_BACKGROUND GETRGB(24, 24, 24)
+#define HUD_MARGIN 8
+
+static const char *kindNames[MEMCACHE_KINDS] = {
+    "data", "thumb", "fullscreen", "fullsize", "tile"
+};
+
+static double toMs(Uint64 ticks) {
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static double toMB(long long bytes) {
+    return bytes / 1048576.0;
+}
+
+JHud *create_hud(SDL_Renderer *renderer, JFont *font) {
+    JHud *hud = (JHud *)calloc(1, sizeof(JHud));
+
+    if(hud == NULL)
+        return NULL;
+
+    hud->renderer = renderer;
+    hud->font = font;
+    hud->lineHeight = font->letter[0]->h + 2;
+    hud->lastKind = -1;
+    hud->windowStart = SDL_GetTicks();
+
+    if((hud->image = create_image(HUD_W, HUD_LINES * hud->lineHeight + 2 * HUD_MARGIN)) == NULL ||
+            (hud->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                    SDL_TEXTUREACCESS_STREAMING, hud->image->w, hud->image->h)) == NULL) {
+        destroy_hud(hud);
+        return NULL;
+    }
+
+    return hud;
+}
+
+void destroy_hud(JHud *hud) {
+    if(hud->texture != NULL)
+        SDL_DestroyTexture(hud->texture);
+    if(hud->image != NULL)
+        destroy_image(hud->image);
+    free(hud);
+}
+
+void hud_frame(JHud *hud, Uint64 ticks) {
+    hud->frameLast = ticks;
+    hud->frameWorst = MAX(hud->frameWorst, ticks);
+    hud->windowFrames++;
+}
+
+void hud_job(JHud *hud, JLoadJob *job) {
+    if(job->image == NULL)
+        return;
+
+    hud->lastKind = job->kind;
+    hud->lastLatency = job->finished - job->submitted;
+    hud->lastTimes = job->times;
+
+    hud->windowImages++;
+    if(job->kind != MEMCACHE_TILE) // a tile is just part of an entry
+        hud->windowBytes += job->jpeg->compressedSize;
+}
+
+static void line(JHud *hud, int n, const char *text) {
+    write_font(hud->image, hud->font, 0xFFFFFF, text,
+            HUD_MARGIN, HUD_MARGIN + n * hud->lineHeight, FONT_ALIGN_TOP + FONT_ALIGN_LEFT, 1);
+}
+
+int hud_update(JHud *hud, JPool *pool, JMemCache *cache, JPrefetch *prefetch, int thumbsLeft) {
+    Uint32 now = SDL_GetTicks();
+    long long kindBytes[MEMCACHE_KINDS], buffered, total = 0;
+    int hits, misses, reads, ready = 0, wanted = 0, i;
+    char text[256];
+    JLoadTimes *t = &hud->lastTimes;
+
+    if(now - hud->lastDraw < HUD_INTERVAL)
+        return 0;
+    hud->lastDraw = now;
+
+    if(now - hud->windowStart >= HUD_WINDOW) {
+        hud->fps = hud->windowFrames * 1000.0 / (now - hud->windowStart);
+        hud->imageRate = hud->windowImages * 1000.0 / (now - hud->windowStart);
+        hud->byteRate = hud->windowBytes * 1000.0 / (now - hud->windowStart);
+        hud->windowFrames = hud->windowImages = 0;
+        hud->windowBytes = 0;
+        hud->windowStart = now;
+    }
+
+    fill_image(hud->image, HUD_BACKGROUND);
+
+    snprintf(text, sizeof(text), "Frame %.1f ms, worst %.1f ms, %.0f fps",
+            toMs(hud->frameLast), toMs(hud->frameWorst), hud->fps);
+    line(hud, 0, text);
+    hud->frameWorst = 0;
+
+    if(hud->lastKind >= 0)
+        snprintf(text, sizeof(text), "Last %s: %.1f ms from submit to done",
+                kindNames[hud->lastKind], toMs(hud->lastLatency));
+    else
+        snprintf(text, sizeof(text), "Last load: none yet");
+    line(hud, 1, text);
+
+    snprintf(text, sizeof(text), "read %.1f inflate %.1f decode %.1f convert %.1f scale %.1f",
+            toMs(t->read), toMs(t->inflate), toMs(t->decode), toMs(t->convert), toMs(t->scale));
+    line(hud, 2, text);
+
+    snprintf(text, sizeof(text), "Loaded %.1f images/s, %.1f MB/s",
+            hud->imageRate, toMB((long long)hud->byteRate));
+    line(hud, 3, text);
+
+    reads = pool_reads(pool, &buffered);
+    snprintf(text, sizeof(text), "Queue %d jobs, %d to read, %.1f MB read ahead, thumbs %s",
+            pool_pending(pool), reads, toMB(buffered), thumbsLeft ? "loading" : "done");
+    line(hud, 4, text);
+
+    memcache_counts(cache, &hits, &misses, kindBytes);
+    for(i = 0; i < MEMCACHE_KINDS; i++)
+        total += kindBytes[i];
+    snprintf(text, sizeof(text), "Cache %.1f / %.1f MB, hits %d of %d (%.0f pct)",
+            toMB(total), toMB(cache->limit), hits, hits + misses,
+            hits + misses ? hits * 100.0 / (hits + misses) : 0.0);
+    line(hud, 5, text);
+
+    snprintf(text, sizeof(text), "MB: %s %.1f %s %.1f %s %.1f %s %.1f %s %.1f",
+            kindNames[0], toMB(kindBytes[0]), kindNames[1], toMB(kindBytes[1]),
+            kindNames[2], toMB(kindBytes[2]), kindNames[3], toMB(kindBytes[3]),
+            kindNames[4], toMB(kindBytes[4]));
+    line(hud, 6, text);
+
+    if(prefetch != NULL) {
+        for(i = 0; i < PREFETCH_MAX; i++) {
+            wanted += prefetch->ringIndex[i] >= 0;
+            ready += prefetch->ringItem[i] != NULL;
+        }
+        snprintf(text, sizeof(text), "Prefetch %d of %d ready, moving %.1f images/s",
+                ready, wanted, prefetch->speed);
+        line(hud, 7, text);
+    }
+
+    SDL_UpdateTexture(hud->texture, NULL, hud->image->data, hud->image->w * sizeof(Uint32));
+
+    return 1;
+}
+
+void hud_render(JHud *hud) {
+    SDL_Rect dest;
+
+    dest.x = dest.y = HUD_MARGIN;
+    dest.w = hud->image->w;
+    dest.h = hud->image->h;
+    SDL_RenderCopy(hud->renderer, hud->texture, NULL, &dest);
+}
@@ -0,0 +1,91 @@
+/**
+ * On-screen performance overlay.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __HUD_H
+#define __HUD_H
+
+#include "SDL2/SDL.h"
+
+#include "font.h"
+#include "image.h"
+#include "loader.h"
+#include "memcache.h"
+#include "pool.h"
+#include "prefetch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Frame times, load latencies and queue and cache state in the top left
+ * corner. Text is drawn into a small image of its own and uploaded to a
+ * texture only every HUD_INTERVAL ms, so frames in between just copy the
+ * texture and the numbers aren't skewed by measuring them.
+ */
+
+#define HUD_INTERVAL 250 // ms between text updates
+#define HUD_WINDOW 1000 // ms over which rates are counted
+#define HUD_W 720
+#define HUD_LINES 8
+
+typedef struct {
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    JImage *image; // text before upload
+    JFont *font;
+    int lineHeight;
+    Uint32 lastDraw; // SDL_GetTicks() of last text update
+
+    Uint64 frameLast, frameWorst; // ticks, worst since last text update
+
+    int lastKind; // latest completed load, -1 if none yet
+    Uint64 lastLatency; // submit to done, ticks
+    JLoadTimes lastTimes;
+
+    Uint32 windowStart; // SDL_GetTicks()
+    int windowFrames, windowImages;
+    long long windowBytes; // compressed bytes of loaded entries
+    double fps, imageRate, byteRate; // from last full window
+} JHud;
+
+JHud *create_hud(SDL_Renderer *renderer, JFont *font);
+
+void destroy_hud(JHud *hud);
+
+// Time spent drawing and presenting a frame
+void hud_frame(JHud *hud, Uint64 ticks);
+
+// Completed pool job, before it's freed
+void hud_job(JHud *hud, JLoadJob *job);
+
+// Redraw text if it's time, returns nonzero if it changed and the screen
+// should be presented again. Prefetch may be NULL.
+int hud_update(JHud *hud, JPool *pool, JMemCache *cache, JPrefetch *prefetch, int thumbsLeft);
+
+// Copy on top of whatever is rendered, before SDL_RenderPresent()
+void hud_render(JHud *hud);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -24,27 +24,43 @@
 #include <string.h>
 
 #include "image.h"
+#include "slab.h"
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#elif defined __ARM_NEON || defined __ARM_NEON__
+#define HAVE_NEON
+#include <arm_neon.h>
+#endif
 
 JImage *create_image(int width, int height) {
-    JImage *img = (JImage *)malloc(sizeof(JImage));
+    JImage *img = slab_create_image(width, height);
 
-    if(img == NULL)
-        return NULL;
+    if(img != NULL)
+        return img;
 
-    img->data = (Uint32 *)malloc(sizeof(Uint32)*width*height);
+    img = (JImage *)malloc(IMAGE_HEADER + sizeof(Uint32)*width*height);
 
-    if(img->data == NULL)
+    if(img == NULL)
         return NULL;
 
+    img->data = (Uint32 *)((unsigned char *)img + IMAGE_HEADER);
     img->w = width;
     img->h = height;
+    img->slab = NULL;
+
+    slab_count_malloc();
 
     return img;
 }
 
 void destroy_image(JImage *img) {
-    free(img->data);
-    free(img);
+    if(img->slab != NULL)
+        slab_destroy_image(img);
+    else
+        free(img);
 }
 
 void copy_image(JImage *dest, JImage *src) {
@@ -54,97 +70,514 @@ void copy_image(JImage *dest, JImage *src) {
     memcpy(dest->data, src->data, src->w * src->h * sizeof(Uint32));
 }
 
-// rotation in 90 degree steps clockwise, 0-3
-void rotate_image(JImage *dest, JImage *src, int angle) {
+/*
+ * Row kernels work on n pixels in a row. Greyscale and invert treat the
+ * whole image as one row. All kernel sets give the same bytes as scalar.
+ */
+typedef void (*JRowFunc)(Uint32 *row, int n);
+// Blend c into dest by low byte of each alpha pixel
+typedef void (*JBlendFunc)(Uint32 *dest, const Uint32 *alpha, int n, Uint32 c);
+
+#define BLEND(c1,c2,a) (((a) * (c1) + (255-(a)) * (c2)) >> 8)
+
+// Simple averaging
+static void greyRow_scalar(Uint32 *row, int n) {
+    int i, avg;
+
+    for(i = 0; i < n; i++) {
+        avg = (GETR(row[i]) + GETG(row[i]) + GETB(row[i])) / 3;
+        row[i] = GETRGB(avg, avg, avg);
+    }
+}
+
+static void invertRow_scalar(Uint32 *row, int n) {
+    int i;
+
+    for(i = 0; i < n; i++)
+        row[i] = 0xFFFFFF - row[i];
+}
+
+static void blendRow_scalar(Uint32 *dest, const Uint32 *alpha, int n, Uint32 c) {
+    int i, a, r = GETR(c), g = GETG(c), b = GETB(c);
+
+    for(i = 0; i < n; i++) {
+        if(!(a = alpha[i] & 255))
+            continue;
+
+        if(a == 255)
+            dest[i] = c;
+        else
+            dest[i] = GETRGB(BLEND(r, GETR(dest[i]), a),
+                    BLEND(g, GETG(dest[i]), a), BLEND(b, GETB(dest[i]), a));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// Channel sums are at most 765, s * 0xAAAB >> 17 is s / 3 exactly for those
+__attribute__((target("sse2")))
+static void greyRow_sse2(Uint32 *row, int n) {
+    __m128i m = _mm_set1_epi32(255), third = _mm_set1_epi16((short)0xAAAB),
+            spread = _mm_set1_epi16(0x0101), a, b, s, avg, lo;
+    int i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        a = _mm_loadu_si128((__m128i *)(row + i));
+        b = _mm_loadu_si128((__m128i *)(row + i + 4));
+        a = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(a, m), _mm_and_si128(_mm_srli_epi32(a, 8), m)),
+                _mm_and_si128(_mm_srli_epi32(a, 16), m));
+        b = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(b, m), _mm_and_si128(_mm_srli_epi32(b, 8), m)),
+                _mm_and_si128(_mm_srli_epi32(b, 16), m));
+        s = _mm_packs_epi32(a, b);
+        avg = _mm_srli_epi16(_mm_mulhi_epu16(s, third), 1);
+        lo = _mm_mullo_epi16(avg, spread); // avg in both bytes, avg alone above
+        _mm_storeu_si128((__m128i *)(row + i), _mm_unpacklo_epi16(lo, avg));
+        _mm_storeu_si128((__m128i *)(row + i + 4), _mm_unpackhi_epi16(lo, avg));
+    }
+
+    greyRow_scalar(row + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void invertRow_sse2(Uint32 *row, int n) {
+    __m128i white = _mm_set1_epi32(0xFFFFFF);
+    int i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(row + i), _mm_sub_epi32(white,
+                    _mm_loadu_si128((__m128i *)(row + i))));
+
+    invertRow_scalar(row + i, n - i);
+}
+
+// Products are at most 255 * 255 so unsigned 16-bit lanes are enough
+__attribute__((target("sse2")))
+static void blendRow_sse2(Uint32 *dest, const Uint32 *alpha, int n, Uint32 c) {
+    __m128i zero = _mm_setzero_si128(), ff = _mm_set1_epi32(255), m255 = _mm_set1_epi16(255),
+            rgb = _mm_set1_epi32(0xFFFFFF), cc = _mm_set1_epi32((int)c),
+            c16 = _mm_unpacklo_epi8(cc, zero), a, d, a16, alo, ahi, lo, hi, is0, is255, out;
+    int i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        a = _mm_and_si128(_mm_loadu_si128((__m128i *)(alpha + i)), ff);
+        d = _mm_loadu_si128((__m128i *)(dest + i));
+        a16 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        alo = _mm_unpacklo_epi32(a16, a16); // alpha of two pixels in all channels
+        ahi = _mm_unpackhi_epi32(a16, a16);
+        lo = _mm_add_epi16(_mm_mullo_epi16(alo, c16),
+                _mm_mullo_epi16(_mm_sub_epi16(m255, alo), _mm_unpacklo_epi8(d, zero)));
+        hi = _mm_add_epi16(_mm_mullo_epi16(ahi, c16),
+                _mm_mullo_epi16(_mm_sub_epi16(m255, ahi), _mm_unpackhi_epi8(d, zero)));
+        out = _mm_and_si128(_mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)), rgb);
+        is0 = _mm_cmpeq_epi32(a, zero);
+        is255 = _mm_cmpeq_epi32(a, ff);
+        out = _mm_or_si128(_mm_and_si128(is255, cc), _mm_andnot_si128(is255, out));
+        out = _mm_or_si128(_mm_and_si128(is0, d), _mm_andnot_si128(is0, out));
+        _mm_storeu_si128((__m128i *)(dest + i), out);
+    }
+
+    blendRow_scalar(dest + i, alpha + i, n - i, c);
+}
+
+// Same as SSE2, packs and unpacks stay within 128-bit lanes so order holds
+__attribute__((target("avx2")))
+static void greyRow_avx2(Uint32 *row, int n) {
+    __m256i m = _mm256_set1_epi32(255), third = _mm256_set1_epi16((short)0xAAAB),
+            spread = _mm256_set1_epi16(0x0101), a, b, s, avg, lo;
+    int i;
+
+    for(i = 0; i + 16 <= n; i += 16) {
+        a = _mm256_loadu_si256((__m256i *)(row + i));
+        b = _mm256_loadu_si256((__m256i *)(row + i + 8));
+        a = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(a, m),
+                    _mm256_and_si256(_mm256_srli_epi32(a, 8), m)), _mm256_and_si256(_mm256_srli_epi32(a, 16), m));
+        b = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(b, m),
+                    _mm256_and_si256(_mm256_srli_epi32(b, 8), m)), _mm256_and_si256(_mm256_srli_epi32(b, 16), m));
+        s = _mm256_packs_epi32(a, b);
+        avg = _mm256_srli_epi16(_mm256_mulhi_epu16(s, third), 1);
+        lo = _mm256_mullo_epi16(avg, spread);
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_unpacklo_epi16(lo, avg));
+        _mm256_storeu_si256((__m256i *)(row + i + 8), _mm256_unpackhi_epi16(lo, avg));
+    }
+
+    greyRow_sse2(row + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void invertRow_avx2(Uint32 *row, int n) {
+    __m256i white = _mm256_set1_epi32(0xFFFFFF);
+    int i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_sub_epi32(white,
+                    _mm256_loadu_si256((__m256i *)(row + i))));
+
+    invertRow_scalar(row + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void blendRow_avx2(Uint32 *dest, const Uint32 *alpha, int n, Uint32 c) {
+    __m256i zero = _mm256_setzero_si256(), ff = _mm256_set1_epi32(255), m255 = _mm256_set1_epi16(255),
+            rgb = _mm256_set1_epi32(0xFFFFFF), cc = _mm256_set1_epi32((int)c),
+            c16 = _mm256_unpacklo_epi8(cc, zero), a, d, a16, alo, ahi, lo, hi, is0, is255, out;
+    int i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        a = _mm256_and_si256(_mm256_loadu_si256((__m256i *)(alpha + i)), ff);
+        d = _mm256_loadu_si256((__m256i *)(dest + i));
+        a16 = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        alo = _mm256_unpacklo_epi32(a16, a16);
+        ahi = _mm256_unpackhi_epi32(a16, a16);
+        lo = _mm256_add_epi16(_mm256_mullo_epi16(alo, c16),
+                _mm256_mullo_epi16(_mm256_sub_epi16(m255, alo), _mm256_unpacklo_epi8(d, zero)));
+        hi = _mm256_add_epi16(_mm256_mullo_epi16(ahi, c16),
+                _mm256_mullo_epi16(_mm256_sub_epi16(m255, ahi), _mm256_unpackhi_epi8(d, zero)));
+        out = _mm256_and_si256(_mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)), rgb);
+        is0 = _mm256_cmpeq_epi32(a, zero);
+        is255 = _mm256_cmpeq_epi32(a, ff);
+        out = _mm256_blendv_epi8(out, cc, is255);
+        out = _mm256_blendv_epi8(out, d, is0);
+        _mm256_storeu_si256((__m256i *)(dest + i), out);
+    }
+
+    blendRow_sse2(dest + i, alpha + i, n - i, c);
+}
+
+#endif // HAVE_X86_SIMD
+
+#ifdef HAVE_NEON
+
+// Pixels are B, G, R, X in memory, vld4q_u8 splits 16 of them by channel
+static void greyRow_neon(Uint32 *row, int n) {
+    uint16x4_t third = vdup_n_u16(0xAAAB);
+    uint16x8_t s;
+    uint8x8_t avg[2];
+    uint8x16x4_t p;
+    int i, k;
+
+    for(i = 0; i + 16 <= n; i += 16) {
+        p = vld4q_u8((const uint8_t *)(row + i));
+        for(k = 0; k < 2; k++) {
+            s = k ? vaddw_u8(vaddl_u8(vget_high_u8(p.val[0]), vget_high_u8(p.val[1])), vget_high_u8(p.val[2])) :
+                vaddw_u8(vaddl_u8(vget_low_u8(p.val[0]), vget_low_u8(p.val[1])), vget_low_u8(p.val[2]));
+            avg[k] = vshrn_n_u16(vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(s), third), 16),
+                        vshrn_n_u32(vmull_u16(vget_high_u16(s), third), 16)), 1);
+        }
+        p.val[0] = p.val[1] = p.val[2] = vcombine_u8(avg[0], avg[1]);
+        p.val[3] = vdupq_n_u8(0);
+        vst4q_u8((uint8_t *)(row + i), p);
+    }
+
+    greyRow_scalar(row + i, n - i);
+}
+
+static void invertRow_neon(Uint32 *row, int n) {
+    uint32x4_t white = vdupq_n_u32(0xFFFFFF);
+    int i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+        vst1q_u32(row + i, vsubq_u32(white, vld1q_u32(row + i)));
+
+    invertRow_scalar(row + i, n - i);
+}
+
+static void blendRow_neon(Uint32 *dest, const Uint32 *alpha, int n, Uint32 c) {
+    uint8x16x4_t d;
+    uint8x16_t a, na, is0, is255, blend;
+    uint8x8_t cv;
+    int i, k;
+
+    for(i = 0; i + 16 <= n; i += 16) {
+        d = vld4q_u8((const uint8_t *)(dest + i));
+        a = vld4q_u8((const uint8_t *)(alpha + i)).val[0];
+        na = vmvnq_u8(a);
+        is0 = vceqq_u8(a, vdupq_n_u8(0));
+        is255 = vceqq_u8(a, vdupq_n_u8(255));
+        for(k = 0; k < 4; k++) {
+            cv = vdup_n_u8((c >> (8 * k)) & 255);
+            blend = (k == 3) ? vdupq_n_u8(0) : vcombine_u8( // top byte ends up zero
+                    vshrn_n_u16(vmlal_u8(vmull_u8(vget_low_u8(a), cv), vget_low_u8(na), vget_low_u8(d.val[k])), 8),
+                    vshrn_n_u16(vmlal_u8(vmull_u8(vget_high_u8(a), cv), vget_high_u8(na), vget_high_u8(d.val[k])), 8));
+            d.val[k] = vbslq_u8(is0, d.val[k], vbslq_u8(is255, vcombine_u8(cv, cv), blend));
+        }
+        vst4q_u8((uint8_t *)(dest + i), d);
+    }
+
+    blendRow_scalar(dest + i, alpha + i, n - i, c);
+}
+
+#endif // HAVE_NEON
+
+static int kernel = -1; // not detected yet
+
+static int hasKernel(int k) {
+    switch(k) {
+    case IMAGE_SCALAR:
+        return 1;
+#ifdef HAVE_X86_SIMD
+    case IMAGE_SSE2:
+        return SDL_HasSSE2();
+    case IMAGE_AVX2:
+        return SDL_HasAVX2();
+#endif
+#ifdef HAVE_NEON
+    case IMAGE_NEON:
+        return 1; // always there where the compiler has it on
+#endif
+    default:
+        return 0;
+    }
+}
+
+static int bestKernel(void) {
+    int k;
+
+    for(k = IMAGE_KERNELS - 1; k > IMAGE_SCALAR && !hasKernel(k); k--)
+        ;
+
+    return k;
+}
+
+int image_set_kernel(int k) {
+    kernel = hasKernel(k) ? k : bestKernel();
+    return kernel;
+}
+
+const char *image_kernel_name(int k) {
+    static const char *names[IMAGE_KERNELS] = { "scalar", "sse2", "avx2", "neon" };
+    return (k >= 0 && k < IMAGE_KERNELS) ? names[k] : "unknown";
+}
+
+static void pickKernels(JRowFunc *grey, JRowFunc *invert, JBlendFunc *blend) {
+    if(kernel < 0) // benign race, all threads get the same answer
+        kernel = bestKernel();
+
+    *grey = greyRow_scalar;
+    *invert = invertRow_scalar;
+    *blend = blendRow_scalar;
+
+#ifdef HAVE_X86_SIMD
+    if(kernel == IMAGE_AVX2) {
+        *grey = greyRow_avx2;
+        *invert = invertRow_avx2;
+        *blend = blendRow_avx2;
+    } else if(kernel == IMAGE_SSE2) {
+        *grey = greyRow_sse2;
+        *invert = invertRow_sse2;
+        *blend = blendRow_sse2;
+    }
+#endif
+#ifdef HAVE_NEON
+    if(kernel == IMAGE_NEON) {
+        *grey = greyRow_neon;
+        *invert = invertRow_neon;
+        *blend = blendRow_neon;
+    }
+#endif
+}
+
+#define ORIENT_TILE 32 // 4 kB of source and destination per tile, fits L1 easily
+
+// Dest pixel (x, y) comes from src->data[base + x * stepX + y * stepY]. For
+// orientations that swap axes stepY is +-1, so a dest row is a src column.
+// 4x4 blocks with stepY +-1: load four src runs, transpose, store rows.
+typedef void (*JBlockFunc)(Uint32 *dest, int destW, const Uint32 *src, int stepX, int stepY);
+
+static void orientBlock_scalar(Uint32 *dest, int destW, const Uint32 *src, int stepX, int stepY) {
     int x, y;
 
-    if(dest->w * dest->h != src->w * src->h)
-        return;
+    for(y = 0; y < 4; y++)
+        for(x = 0; x < 4; x++)
+            dest[y * destW + x] = src[x * stepX + y * stepY];
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void orientBlock_sse2(Uint32 *dest, int destW, const Uint32 *src, int stepX, int stepY) {
+    __m128i r[4], t0, t1, t2, t3;
+    int i;
+
+    for(i = 0; i < 4; i++) // src run for dest column i
+        r[i] = (stepY > 0) ? _mm_loadu_si128((__m128i *)(src + i * stepX)) :
+            _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(src + i * stepX - 3)), 0x1B);
+
+    t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    t3 = _mm_unpackhi_epi32(r[2], r[3]);
+    _mm_storeu_si128((__m128i *)dest, _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dest + destW), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dest + 2 * destW), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(dest + 3 * destW), _mm_unpackhi_epi64(t2, t3));
+}
+
+#endif // HAVE_X86_SIMD
+
+#ifdef HAVE_NEON
+
+static void orientBlock_neon(Uint32 *dest, int destW, const Uint32 *src, int stepX, int stepY) {
+    uint32x4_t r[4], v;
+    uint32x4x2_t t01, t23;
+    int i;
 
-    if(angle == 1 || angle == 3) {
-        dest->w = src->h;
-        dest->h = src->w;
-    } else {
-        dest->h = src->h;
-        dest->w = src->w;
+    for(i = 0; i < 4; i++) {
+        if(stepY > 0)
+            r[i] = vld1q_u32(src + i * stepX);
+        else {
+            v = vrev64q_u32(vld1q_u32(src + i * stepX - 3));
+            r[i] = vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+        }
     }
 
-    switch(angle) {
-    case 1:
-        for(y=0; y<src->h; y++)
-        for(x=0; x<src->w; x++)
-            SETPIXEL(dest, src->h - 1 - y, x, GETPIXEL(src, x, y));
-        break;
-    case 2:
-        for(y=0; y<src->h; y++)
-        for(x=0; x<src->w; x++)
-            SETPIXEL(dest, dest->w - 1 - x, dest->h - 1 - y, GETPIXEL(src, x, y));
-        break;
-    case 3:
-        for(y=0; y<src->h; y++)
-        for(x=0; x<src->w; x++)
-            SETPIXEL(dest, y, src->w - 1 - x, GETPIXEL(src, x, y));
-        break;
+    t01 = vtrnq_u32(r[0], r[1]);
+    t23 = vtrnq_u32(r[2], r[3]);
+    vst1q_u32(dest, vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+    vst1q_u32(dest + destW, vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+    vst1q_u32(dest + 2 * destW, vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+    vst1q_u32(dest + 3 * destW, vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+}
+
+#endif // HAVE_NEON
+
+void orient_image(JImage *dest, JImage *src, int orientation) {
+    JBlockFunc block = orientBlock_scalar;
+    int W = src->w, H = src->h, base, stepX, stepY, x, y, tx, ty, xe, ye, x4, y4;
+    const Uint32 *from;
+    Uint32 *to;
+
+    if(dest->w * dest->h != W * H)
+        return;
+
+    switch(orientation) {
+    case 2: base = W - 1; stepX = -1; stepY = W; break; // mirrored
+    case 3: base = (H - 1) * W + W - 1; stepX = -1; stepY = -W; break; // 180
+    case 4: base = (H - 1) * W; stepX = 1; stepY = -W; break; // upside down mirror
+    case 5: base = 0; stepX = W; stepY = 1; break; // transposed
+    case 6: base = (H - 1) * W; stepX = -W; stepY = 1; break; // 90 clockwise
+    case 7: base = (H - 1) * W + W - 1; stepX = -W; stepY = -1; break; // transversed
+    case 8: base = W - 1; stepX = W; stepY = -1; break; // 90 counterclockwise
     default:
+        dest->w = W;
+        dest->h = H;
         copy_image(dest, src);
-        break;
+        return;
     }
-}
 
-// make a greyscale image through simple averaging
-void greyscale_image(JImage *img) {
-    int x, y, avg;
-    Uint32 c;
-
-    for(y=0; y<img->h; y++) {
-        for(x=0; x<img->w; x++) {
-            c = GETPIXEL(img, x, y);
-            avg = (GETR(c) + GETG(c) + GETB(c)) / 3;
-            SETPIXEL(img, x, y, GETRGB(avg,avg,avg));
+    dest->w = ORIENT_SWAPS(orientation) ? H : W;
+    dest->h = ORIENT_SWAPS(orientation) ? W : H;
+
+    if(!ORIENT_SWAPS(orientation)) { // rows stay rows, no tiling needed
+        for(y = 0; y < dest->h; y++) {
+            from = src->data + base + y * stepY;
+            to = dest->data + y * dest->w;
+            if(stepX > 0)
+                memcpy(to, from, dest->w * sizeof(Uint32));
+            else for(x = 0; x < dest->w; x++)
+                to[x] = from[-x];
         }
+        return;
     }
+
+    if(kernel < 0)
+        kernel = bestKernel();
+#ifdef HAVE_X86_SIMD
+    if(kernel != IMAGE_SCALAR)
+        block = orientBlock_sse2;
+#endif
+#ifdef HAVE_NEON
+    if(kernel == IMAGE_NEON)
+        block = orientBlock_neon;
+#endif
+
+    for(ty = 0; ty < dest->h; ty += ORIENT_TILE) {
+        ye = MIN(ty + ORIENT_TILE, dest->h);
+        y4 = ty + (ye - ty) / 4 * 4;
+        for(tx = 0; tx < dest->w; tx += ORIENT_TILE) {
+            xe = MIN(tx + ORIENT_TILE, dest->w);
+            x4 = tx + (xe - tx) / 4 * 4;
+
+            for(y = ty; y < y4; y += 4)
+                for(x = tx; x < x4; x += 4)
+                    block(dest->data + y * dest->w + x, dest->w,
+                            src->data + base + x * stepX + y * stepY, stepX, stepY);
+
+            for(y = ty; y < ye; y++) // right and bottom edges of the tile
+                for(x = (y < y4) ? x4 : tx; x < xe; x++)
+                    dest->data[y * dest->w + x] = src->data[base + x * stepX + y * stepY];
+        }
+    }
+}
+
+// rotation in 90 degree steps clockwise, 0-3
+void rotate_image(JImage *dest, JImage *src, int angle) {
+    static const int orientations[4] = { 1, 6, 3, 8 };
+
+    orient_image(dest, src, orientations[angle & 3]);
+}
+
+void greyscale_image(JImage *img) {
+    JRowFunc grey, invert;
+    JBlendFunc blend;
+
+    pickKernels(&grey, &invert, &blend);
+    grey(img->data, img->w * img->h);
 }
 
 // invert image colors
 void invert_image(JImage *img) {
-    int x, y;
+    JRowFunc grey, invert;
+    JBlendFunc blend;
 
-    for(y=0; y<img->h; y++) {
-        for(x=0; x<img->w; x++) {
-            SETPIXEL(img, x, y, 0xFFFFFF - GETPIXEL(img, x, y));
-        }
-    }
+    pickKernels(&grey, &invert, &blend);
+    invert(img->data, img->w * img->h);
 }
 
-void fill_image(JImage *img, Uint32 c) {
+static void fillRow(Uint32 *row, int n, Uint32 c) {
     int i;
 
-    for(i=0; i<img->w * img->h; i++)
-        img->data[i] = c;
+    if(c == (c & 255) * 0x01010101U) // black, white etc.
+        memset(row, c & 255, n * sizeof(Uint32));
+    else for(i = 0; i < n; i++) // compiler vectorizes this
+        row[i] = c;
+}
+
+void fill_image(JImage *img, Uint32 c) {
+    fillRow(img->data, img->w * img->h, c);
+}
+
+void fill_rect(JImage *img, int x, int y, int w, int h, Uint32 c) {
+    int j, left = MAX(x, 0), right = MIN(x + w, img->w);
+
+    if(left >= right)
+        return;
+
+    for(j = MAX(y, 0); j < y + h && j < img->h; j++)
+        fillRow(img->data + j * img->w + left, right - left, c);
 }
 
 void blit_image(JImage *dest, int dx, int dy, JImage *src, int sx, int sy, int w, int h) {
-    int x, y;
+    int y;
 
     // Clipping
     if(dx < 0) {
         w += dx;
-        sx += dx;
+        sx -= dx;
         dx = 0;
     }
     if(dy < 0) {
         h += dy;
-        sy += dy;
+        sy -= dy;
         dy = 0;
     }
     if(sx < 0) {
         w += sx;
-        dx += sx;
+        dx -= sx;
         sx = 0;
     }
     if(sy < 0) {
         h += sy;
-        dy += sy;
+        dy -= sy;
         sy = 0;
     }
     if(dx + w > dest->w)
@@ -159,39 +592,29 @@ void blit_image(JImage *dest, int dx, int dy, JImage *src, int sx, int sy, int w
     if(dx >= dest->w || dy >= dest->h || w <= 0 || h <= 0)
         return;
 
-    for(y=0; y<h; y++)
-        for(x=0; x<w; x++)
-            SETPIXEL(dest, dx+x, dy+y, GETPIXEL(src, sx+x, sy+y));
+    for(y=0; y<h; y++) // memmove, dest may be src
+        memmove(dest->data + (dy + y) * dest->w + dx, src->data + (sy + y) * src->w + sx,
+                w * sizeof(Uint32));
 }
 
 void blit_sprite(JImage *dest, int dx, int dy, JImage *sprite) {
     blit_image(dest, dx, dy, sprite, 0, 0, sprite->w, sprite->h);
 }
 
-#define BLEND(c1,c2,a) (((a) * (c1) + (255-(a)) * (c2)) >> 8)
-
 // Assumes alpha-only letter
 void blit_font(JImage *image, JImage *letter, int x, int y, Uint32 c) {
-    int i, j, alpha, r = GETR(c), g = GETG(c), b = GETB(c);
-    Uint32 d;
-
-    for(j=MAX(0, -y); j<letter->h && y+j < image->h; j++) {
-        for(i=MAX(0, -x); i<letter->w && x+i < image->w; i++) {
-            alpha = GETPIXEL(letter, i, j) & 255;
-
-            if(!alpha) continue;
-
-            if(alpha == 255) {
-                SETPIXEL(image, x+i, y+j, c);
-            } else {
-                d = GETPIXEL(image, x+i, y+j);
-                SETPIXEL(image, x+i, y+j, GETRGB(
-                            BLEND(r, GETR(d), alpha),
-                            BLEND(g, GETG(d), alpha),
-                            BLEND(b, GETB(d), alpha)));
-            }
-        }
-    }
+    JRowFunc grey, invert;
+    JBlendFunc blend;
+    int j, left = MAX(0, -x), right = MIN(letter->w, image->w - x);
+
+    if(left >= right)
+        return;
+
+    pickKernels(&grey, &invert, &blend);
+
+    for(j=MAX(0, -y); j<letter->h && y+j < image->h; j++)
+        blend(image->data + (y + j) * image->w + x + left,
+                letter->data + j * letter->w + left, right - left, c);
 }
 
 JImage *read_PNG_file(const char *file_name) {
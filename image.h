@@ -32,12 +32,18 @@
 extern "C" {
 #endif // __cplusplus
 
+struct JSlab;
+
 typedef struct {
     Uint32 *data;
     int w;
     int h;
+    struct JSlab *slab; // NULL if malloc'd with header, see slab.h
 } JImage;
 
+// Pixels follow the header in the same block, from this offset
+#define IMAGE_HEADER ((sizeof(JImage) + 31) & ~(size_t)31)
+
 #define GETPIXEL(img, x, y) ((img)->data[(y) * (img)->w + (x)])
 #define SETPIXEL(img, x, y, c) { (img)->data[(y) * (img)->w + (x)] = (c); }
 #define GETRGB(r,g,b) (((r)<<16)+((g)<<8)+(b))
@@ -57,6 +63,7 @@ typedef struct {
 #define SWAP(a,b,t) { t = a; a = b; b = t; }
 #endif
 
+// Slab slot for thumbnail sized images, otherwise one malloc
 JImage *create_image(int width, int height);
 
 void destroy_image(JImage *img);
@@ -66,12 +73,33 @@ void copy_image(JImage *dest, JImage *src);
 // rotation in 90 degree steps clockwise, 0-3
 void rotate_image(JImage *dest, JImage *src, int angle);
 
+// EXIF orientations 5-8 turn width into height and vice versa
+#define ORIENT_SWAPS(o) ((o) >= 5 && (o) <= 8)
+
+// Apply EXIF orientation 1-8 (flips and rotations) of src to dest, which
+// needs as many pixels and gets w and h set. Works through cache sized
+// tiles so big images don't thrash the cache and TLB.
+void orient_image(JImage *dest, JImage *src, int orientation);
+
+// Kernel sets for greyscale, invert and font blending, picked by CPU unless
+// forced. Fills and blits are memset/memcpy per row on every set.
+enum { IMAGE_SCALAR, IMAGE_SSE2, IMAGE_AVX2, IMAGE_NEON, IMAGE_KERNELS };
+
+// Force a kernel set, for testing. Returns the set actually used, the best
+// one available if CPU doesn't support the requested one. Not thread safe.
+int image_set_kernel(int kernel);
+
+const char *image_kernel_name(int kernel);
+
 void greyscale_image(JImage *img);
 
 void invert_image(JImage *img);
 
 void fill_image(JImage *img, Uint32 c);
 
+// Clipped to image
+void fill_rect(JImage *img, int x, int y, int w, int h, Uint32 c);
+
 void blit_image(JImage *dest, int dx, int dy, JImage *src, int sx, int sy, int w, int h);
 
 // Blits the whole sprite
@@ -0,0 +1,982 @@
+/**
+ * Image loading from ZIP entries.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#if defined _WIN32 || defined _WIN64
+#include "windows.h"
+
+#define HAVE_BOOLEAN /* Fix jpeglib */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <zlib.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#if defined _WIN32 || defined _WIN64
+#undef HAVE_STDDEF_H /* Fix SDL warning */
+#endif
+
+#include "loader.h"
+#include "mapfile.h"
+#include "resample.h"
+#include "exif.h"
+#include "slab.h"
+#include "trace.h"
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_SIMD
+#include <tmmintrin.h>
+#endif
+
+// libjpeg-turbo can write our pixel format directly, plain libjpeg can't
+#ifdef JCS_ALPHA_EXTENSIONS
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define JCS_NATIVE JCS_EXT_BGRA
+#else
+#define JCS_NATIVE JCS_EXT_ARGB
+#endif
+#endif
+
+// Decoding only part of the columns and skipping rows without IDCT
+#if defined LIBJPEG_TURBO_VERSION_NUMBER && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define HAVE_JPEG_CROP
+#endif
+
+// JZFile is not thread safe (and neither is junzip's internal buffer), so
+// archive access goes through this unless the file does positional reads.
+static SDL_mutex *zipLock = NULL;
+
+static JMemCache *dataCache = NULL;
+
+void init_loader(JMemCache *cache) {
+    if(zipLock == NULL)
+        zipLock = SDL_CreateMutex();
+    dataCache = cache;
+    resample_set_kernel(RESAMPLE_KERNELS); // pick best now, not racing in threads
+}
+
+void quit_loader(void) {
+    if(zipLock != NULL)
+        SDL_DestroyMutex(zipLock);
+    zipLock = NULL;
+    dataCache = NULL;
+}
+
+// Scale to fit given max size (w/h), keeping aspect ratio
+JImage *scale(JImage *image, int w, int h) {
+    Uint64 span = trace_start();
+    JImage *scaled;
+    int w2, h2;
+
+    if(w * image->h > image->w * h) { // screen is wider
+        w2 = image->w * h / image->h;
+        h2 = h;
+    } else { // screen is higher
+        w2 = w;
+        h2 = image->h * w / image->w;
+    }
+
+    scaled = resample_image(image, MAX(w2, 1), MAX(h2, 1));
+    trace_end("scale", span);
+
+    return scaled;
+}
+
+#ifndef JCS_NATIVE
+
+// Expand w RGB pixels at start of row in place to 32-bit pixels, backwards
+static void expandRow_scalar(unsigned char *row, int from, int w) {
+    unsigned char *p;
+    int x;
+
+    for(x = w - 1; x >= from; x--) {
+        p = row + x * 3;
+        ((Uint32 *)row)[x] = 0xFF000000 | GETRGB(p[0], p[1], p[2]);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("ssse3")))
+static void expandRow_ssse3(unsigned char *row, int w) {
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    int x = w & ~3;
+
+    expandRow_scalar(row, x, w); // last pixels first, blocks below overwrite them
+
+    // Loads read 4 bytes past the block, still inside the 4w byte row
+    for(x -= 4; x >= 0; x -= 4)
+        _mm_storeu_si128((__m128i *)(row + x * 4), _mm_or_si128(alpha,
+                    _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(row + x * 3)), shuffle)));
+}
+#endif
+
+static void expandRow(unsigned char *row, int w) {
+#ifdef HAVE_X86_SIMD
+    static int ssse3 = -1;
+
+    if(ssse3 < 0) // benign race, all threads get the same answer
+        ssse3 = SDL_HasSSSE3();
+
+    if(ssse3 && w >= 4) {
+        expandRow_ssse3(row, w);
+        return;
+    }
+#endif
+    expandRow_scalar(row, 0, w);
+}
+
+#endif // JCS_NATIVE
+
+// Per-decode error state, so several threads can decode at once
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} JPEGErrorMgr;
+
+static void error_exit(j_common_ptr cinfo) {
+    longjmp(((JPEGErrorMgr *)cinfo->err)->setjmp_buffer, 1);
+}
+
+// Decode and optionally report full image size (before DCT scaling). Data
+// comes from source if it's not NULL, inbuffer and insize are unused then.
+// With orientation, EXIF orientation is reported and tx, ty are for the
+// image as shown. Image is still returned as stored, see scaleLoaded().
+// Scratch images are for decodes that are scaled and freed right away.
+static JImage *decodeJPEG(unsigned char *inbuffer, unsigned long insize,
+        struct jpeg_source_mgr *source, int tx, int ty, JLoadTimes *times,
+        int *fullW, int *fullH, int *orientation, int scratch) {
+    struct jpeg_decompress_struct cinfo;
+    jpeg_saved_marker_ptr marker;
+    JPEGErrorMgr jerr;
+
+    JSAMPARRAY rows;      /* Output row pointers, straight into image */
+    JImage * volatile image = NULL;
+    Uint64 start = SDL_GetPerformanceCounter();
+    volatile Uint64 convert = 0;
+#ifndef JCS_NATIVE
+    JDIMENSION first;
+    Uint64 t;
+#endif
+    int y;
+
+    if(orientation != NULL)
+        *orientation = 1;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit; // catch errors and skip instead of exiting
+
+    if(setjmp(jerr.setjmp_buffer)) { // return whatever we got so far
+        jpeg_destroy_decompress(&cinfo);
+        if(times != NULL) {
+            times->decode += SDL_GetPerformanceCounter() - start - convert;
+            times->convert += convert;
+        }
+        return image;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if(source != NULL)
+        cinfo.src = source;
+    else
+        jpeg_mem_src(&cinfo, inbuffer, insize);
+    if(orientation != NULL)
+        jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_read_header(&cinfo, TRUE);
+
+    if(fullW != NULL) *fullW = cinfo.image_width;
+    if(fullH != NULL) *fullH = cinfo.image_height;
+
+    for(marker = cinfo.marker_list; orientation != NULL && marker != NULL; marker = marker->next)
+        if(marker->marker == JPEG_APP0 + 1 && (*orientation =
+                    exif_orientation_app1(marker->data, marker->data_length)) > 1)
+            break;
+
+    if(orientation != NULL && ORIENT_SWAPS(*orientation))
+        SWAP(tx, ty, y); // target is for the image turned
+
+#ifdef JCS_NATIVE
+    cinfo.out_color_space = JCS_NATIVE; // decode right into 32-bit pixels
+#else
+    cinfo.out_color_space = JCS_RGB; // make RGB even from greyscale
+#endif
+    cinfo.dct_method = JDCT_ISLOW; // best quality, not really slower than IFAST or FLOAT
+
+    if(tx && ty) { // scale_num / 8, libjpeg-turbo defaults to 1 / 1
+        cinfo.scale_num = cinfo.scale_denom = 8;
+        if(cinfo.image_width / 8 > tx || cinfo.image_height / 8 > ty)
+            cinfo.scale_num = 1;
+        else if(cinfo.image_width / 4 > tx || cinfo.image_height / 4 > ty)
+            cinfo.scale_num = 2;
+        else if(cinfo.image_width / 2 > tx || cinfo.image_height / 2 > ty)
+            cinfo.scale_num = 4;
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    image = scratch ? create_scratch_image(cinfo.output_width, cinfo.output_height) :
+        create_image(cinfo.output_width, cinfo.output_height);
+
+    if(image == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    /* Row pointer array that will go away when done with image */
+    rows = (JSAMPARRAY)(*cinfo.mem->alloc_small)((j_common_ptr) &cinfo,
+            JPOOL_IMAGE, image->h * sizeof(JSAMPROW));
+    for(y=0; y<image->h; y++)
+        rows[y] = (JSAMPROW)(image->data + y * image->w);
+
+    while(cinfo.output_scanline < cinfo.output_height) {
+#ifdef JCS_NATIVE
+        jpeg_read_scanlines(&cinfo, rows + cinfo.output_scanline,
+                cinfo.output_height - cinfo.output_scanline);
+#else
+        // RGB lands in the first 3/4 of each row, expand it in place
+        first = cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, rows + first, cinfo.output_height - first);
+        t = SDL_GetPerformanceCounter();
+        for(y=first; y<(int)cinfo.output_scanline; y++)
+            expandRow(rows[y], image->w);
+        convert += SDL_GetPerformanceCounter() - t;
+#endif
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    if(times != NULL) {
+        times->decode += SDL_GetPerformanceCounter() - start - convert;
+        times->convert += convert;
+    }
+
+    return image;
+}
+
+JImage *read_JPEG_custom(unsigned char *inbuffer, unsigned long insize,
+        int tx, int ty) {
+    return read_JPEG_timed(inbuffer, insize, tx, ty, NULL);
+}
+
+static JImage *decodeBuffer(unsigned char *inbuffer, unsigned long insize,
+        int tx, int ty, JLoadTimes *times, int *orientation, int scratch) {
+    Uint64 span = trace_start();
+    JImage *image = decodeJPEG(inbuffer, insize, NULL, tx, ty, times, NULL, NULL, orientation, scratch);
+
+    trace_end("decode", span);
+
+    return image;
+}
+
+JImage *read_JPEG_timed(unsigned char *inbuffer, unsigned long insize,
+        int tx, int ty, JLoadTimes *times) {
+    return decodeBuffer(inbuffer, insize, tx, ty, times, NULL, 0);
+}
+
+#define REGION_MARGIN 16
+
+// Decode w * h pixels at (x, y) of image DCT scaled by 1 / 2^level. Only rows
+// up to the region are decoded, and libjpeg-turbo also skips their IDCT
+// and decodes just the columns needed (widened to iMCU boundaries).
+static JImage *decodeRegion(unsigned char *inbuffer, unsigned long insize,
+        int level, int x, int y, int w, int h) {
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorMgr jerr;
+    JImage * volatile image = NULL;
+    unsigned char * volatile row = NULL;
+    JSAMPROW rowp;
+    JDIMENSION left, width;
+    int j, top;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit;
+
+    if(setjmp(jerr.setjmp_buffer)) { // partial tiles are of no use
+        jpeg_destroy_decompress(&cinfo);
+        free(row);
+        if(image != NULL)
+            destroy_image(image);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, inbuffer, insize);
+    jpeg_read_header(&cinfo, TRUE);
+
+#ifdef JCS_NATIVE
+    cinfo.out_color_space = JCS_NATIVE;
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+    cinfo.dct_method = JDCT_ISLOW;
+    cinfo.scale_num = 8 >> level;
+    cinfo.scale_denom = 8;
+
+    jpeg_start_decompress(&cinfo);
+
+    if(x < 0 || y < 0 || w < 1 || h < 1 ||
+            x + w > (int)cinfo.output_width || y + h > (int)cinfo.output_height) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    // Upsampling uses neighbouring pixels, so decode a margin around the
+    // region, otherwise tile edges would differ slightly from full decode
+    left = MAX(x - REGION_MARGIN, 0);
+    width = MIN(x + w + REGION_MARGIN, (int)cinfo.output_width) - left;
+    top = MAX(y - REGION_MARGIN, 0);
+
+#ifdef HAVE_JPEG_CROP
+    jpeg_crop_scanline(&cinfo, &left, &width); // output_width is now width
+    if(top)
+        jpeg_skip_scanlines(&cinfo, top);
+#else
+    left = 0;
+#endif
+
+    if((row = (unsigned char *)malloc(cinfo.output_width * sizeof(Uint32))) == NULL ||
+            (image = create_image(w, h)) == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        free(row);
+        return NULL;
+    }
+
+    rowp = row;
+    while(cinfo.output_scanline < (JDIMENSION)y) // no skipping in plain libjpeg
+        jpeg_read_scanlines(&cinfo, &rowp, 1);
+
+    for(j = 0; j < h; j++) {
+        jpeg_read_scanlines(&cinfo, &rowp, 1);
+#ifndef JCS_NATIVE
+        expandRow(row, cinfo.output_width);
+#endif
+        memcpy(image->data + j * w, (Uint32 *)row + (x - left), w * sizeof(Uint32));
+    }
+
+    jpeg_destroy_decompress(&cinfo); // rest of the rows are not needed
+    free(row);
+
+    return image;
+}
+
+// Raw deflate from one memory buffer to another, no intermediate copies
+static int inflateBuffer(unsigned char *in, long inSize, unsigned char *out, long outSize) {
+    Uint64 span = trace_start();
+    z_stream strm;
+    int ret;
+
+    memset(&strm, 0, sizeof(strm));
+
+    // Use inflateInit2 with negative window bits to indicate raw data
+    if((ret = inflateInit2(&strm, -MAX_WBITS)) != Z_OK)
+        return ret;
+
+    strm.next_in = in;
+    strm.avail_in = inSize;
+    strm.next_out = out;
+    strm.avail_out = outSize;
+
+    ret = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+    trace_end("inflate", span);
+
+    return (ret == Z_STREAM_END || (ret == Z_BUF_ERROR && !strm.avail_out)) ? Z_OK : Z_DATA_ERROR;
+}
+
+const unsigned char *findEntryData(const unsigned char *buf, size_t size, Sint64 bufOffset, JPEGRecord *jpeg) {
+    const unsigned char *local;
+    size_t start;
+
+    if(jpeg->offset < bufOffset || (Uint64)(jpeg->offset - bufOffset) + 30 > size)
+        return NULL;
+
+    local = buf + (jpeg->offset - bufOffset); // local file header, skip name and extra field
+    if(local[0] != 'P' || local[1] != 'K' || local[2] != 3 || local[3] != 4)
+        return NULL;
+
+    start = (size_t)(jpeg->offset - bufOffset) + 30 + (local[26] | local[27] << 8) + (local[28] | local[29] << 8);
+    if((Uint64)start + jpeg->compressedSize > size)
+        return NULL;
+
+    return buf + start;
+}
+
+// Compressed entry data inside a mapped archive, NULL if not mapped
+static unsigned char *mappedEntry(JZFile *zip, JPEGRecord *jpeg) {
+    const unsigned char *base;
+    size_t size;
+
+    if((base = jzfile_mapping(zip, &size)) == NULL)
+        return NULL;
+
+    return (unsigned char *)findEntryData(base, size, 0, jpeg);
+}
+
+long readArchive(JZFile *zip, Sint64 offset, unsigned char *buf, long size) {
+    Uint64 span = trace_start();
+    long n;
+
+    if(jzfile_positional(zip)) // mapped or pread, no shared file position
+        n = (long)jzfile_read_at(zip, offset, buf, size);
+    else {
+        SDL_LockMutex(zipLock);
+        n = (long)jzfile_read_at(zip, offset, buf, size);
+        SDL_UnlockMutex(zipLock);
+    }
+
+    trace_end("read", span);
+
+    return n;
+}
+
+// Archive offset of entry data after local header, -1 if it can't be read
+static Sint64 entryDataOffset(JZFile *zip, JPEGRecord *jpeg) {
+    Uint64 span = trace_start();
+    unsigned char local[30];
+    long n = readArchive(zip, jpeg->offset, local, 30);
+
+    trace_end("local header", span);
+
+    if(n != 30 || local[0] != 'P' || local[1] != 'K' || local[2] != 3 || local[3] != 4)
+        return -1;
+
+    return jpeg->offset + 30 + (local[26] | local[27] << 8) + (local[28] | local[29] << 8);
+}
+
+unsigned char *readEntryData(JZFile *zip, JPEGRecord *jpeg, JLoadTimes *times) {
+    unsigned char *raw, *data;
+    Uint64 start = SDL_GetPerformanceCounter();
+    Sint64 offset;
+    int ok;
+
+    if(jpeg->method != 0 && jpeg->method != 8)
+        return NULL; // unsupported compression
+
+    if((raw = mappedEntry(zip, jpeg)) != NULL) { // no locking or reading needed
+        if((data = (unsigned char *)malloc(jpeg->size)) == NULL)
+            return NULL;
+
+        if(jpeg->method == 0)
+            memcpy(data, raw, jpeg->size);
+        else if(inflateBuffer(raw, jpeg->compressedSize, data, jpeg->size) != Z_OK) {
+            free(data);
+            return NULL;
+        }
+
+        if(times != NULL)
+            times->inflate += SDL_GetPerformanceCounter() - start;
+
+        return data;
+    }
+
+    if((raw = (unsigned char *)malloc(jpeg->compressedSize)) == NULL)
+        return NULL;
+
+    // Only the reads need the lock, inflating can run in parallel
+    ok = (offset = entryDataOffset(zip, jpeg)) >= 0 &&
+        readArchive(zip, offset, raw, (long)jpeg->compressedSize) == jpeg->compressedSize;
+
+    if(times != NULL)
+        times->read += SDL_GetPerformanceCounter() - start;
+
+    if(!ok) {
+        free(raw);
+        return NULL;
+    }
+
+    if(jpeg->method == 0) // stored, we are done
+        return raw;
+
+    start = SDL_GetPerformanceCounter();
+
+    if((data = (unsigned char *)malloc(jpeg->size)) == NULL) {
+        free(raw);
+        return NULL;
+    }
+
+    if(inflateBuffer(raw, jpeg->compressedSize, data, jpeg->size) != Z_OK) {
+        free(data);
+        data = NULL;
+    }
+
+    free(raw);
+
+    if(times != NULL)
+        times->inflate += SDL_GetPerformanceCounter() - start;
+
+    return data;
+}
+
+#define STREAM_CHUNK 65536
+
+// libjpeg data source that reads and inflates entry data as the decoder
+// asks for it, so the whole uncompressed JPEG is never in memory
+typedef struct {
+    struct jpeg_source_mgr pub;
+    JZFile *zip;
+    JPEGRecord *jpeg;
+    z_stream strm;
+    Sint64 rawPos, rawLeft; // compressed bytes still in archive, 0 if mapped
+    int error; // read or inflate failed, image is not usable
+    JLoadTimes times; // read and inflate
+    unsigned char raw[STREAM_CHUNK], out[STREAM_CHUNK];
+} JZipSource;
+
+static void initZipSource(j_decompress_ptr cinfo) {
+    (void)cinfo;
+}
+
+static void termZipSource(j_decompress_ptr cinfo) {
+    (void)cinfo;
+}
+
+// Next piece of compressed data from archive, returns bytes read
+static long readRaw(JZipSource *src, unsigned char *buf, long size) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    long n = (long)MIN(size, src->rawLeft);
+
+    if(n <= 0)
+        return 0;
+
+    if(readArchive(src->zip, src->rawPos, buf, n) != n) {
+        src->error = 1;
+        n = 0;
+    }
+
+    src->rawPos += n;
+    src->rawLeft -= n;
+    src->times.read += SDL_GetPerformanceCounter() - start;
+
+    return n;
+}
+
+// Inflate more into out, returns bytes produced, 0 at end or on errors
+static long inflateMore(JZipSource *src) {
+    Uint64 start, span;
+    int ret;
+
+    src->strm.next_out = src->out;
+    src->strm.avail_out = STREAM_CHUNK;
+
+    while(src->strm.avail_out == STREAM_CHUNK && !src->error) {
+        if(!src->strm.avail_in) {
+            if((src->strm.avail_in = readRaw(src, src->raw, STREAM_CHUNK)) == 0)
+                break; // end of data
+            src->strm.next_in = src->raw;
+        }
+
+        start = SDL_GetPerformanceCounter();
+        span = trace_start();
+        ret = inflate(&src->strm, Z_NO_FLUSH);
+        src->times.inflate += SDL_GetPerformanceCounter() - start;
+        trace_end("inflate", span);
+
+        if(ret == Z_STREAM_END)
+            break;
+        if(ret != Z_OK && ret != Z_BUF_ERROR)
+            src->error = 1;
+    }
+
+    return STREAM_CHUNK - src->strm.avail_out;
+}
+
+static boolean fillZipSource(j_decompress_ptr cinfo) {
+    JZipSource *src = (JZipSource *)cinfo->src;
+    long n;
+
+    if(src->jpeg->method == 0)
+        n = readRaw(src, src->out, STREAM_CHUNK);
+    else
+        n = inflateMore(src);
+
+    if(n == 0) { // like jpeg_mem_src, end the image instead of failing
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->out[0] = 0xFF;
+        src->out[1] = JPEG_EOI;
+        n = 2;
+    }
+
+    src->pub.next_input_byte = src->out;
+    src->pub.bytes_in_buffer = n;
+
+    return TRUE;
+}
+
+static void skipZipSource(j_decompress_ptr cinfo, long count) {
+    struct jpeg_source_mgr *src = cinfo->src;
+
+    if(count <= 0)
+        return;
+
+    while(count > (long)src->bytes_in_buffer) {
+        count -= src->bytes_in_buffer;
+        fillZipSource(cinfo);
+    }
+
+    src->next_input_byte += count;
+    src->bytes_in_buffer -= count;
+}
+
+static void closeZipSource(JZipSource *src) {
+    if(src->jpeg->method == 8)
+        inflateEnd(&src->strm);
+    free(src);
+}
+
+// Data is read from zip unless raw (compressed entry data) is in memory
+static JZipSource *openZipSource(JZFile *zip, JPEGRecord *jpeg, const unsigned char *raw) {
+    JZipSource *src;
+
+    if(jpeg->method != 0 && jpeg->method != 8)
+        return NULL;
+
+    if((src = (JZipSource *)calloc(1, sizeof(JZipSource))) == NULL)
+        return NULL;
+
+    src->zip = zip;
+    src->jpeg = jpeg;
+    src->pub.init_source = initZipSource;
+    src->pub.fill_input_buffer = fillZipSource;
+    src->pub.skip_input_data = skipZipSource;
+    src->pub.resync_to_restart = jpeg_resync_to_restart;
+    src->pub.term_source = termZipSource;
+
+    if(jpeg->method == 8 && inflateInit2(&src->strm, -MAX_WBITS) != Z_OK) {
+        free(src);
+        return NULL;
+    }
+
+    if(raw != NULL || (raw = mappedEntry(zip, jpeg)) != NULL) { // all there already
+        if(jpeg->method == 0) {
+            src->pub.next_input_byte = raw;
+            src->pub.bytes_in_buffer = jpeg->size;
+        } else {
+            src->strm.next_in = (unsigned char *)raw;
+            src->strm.avail_in = jpeg->compressedSize;
+        }
+        return src;
+    }
+
+    if((src->rawPos = entryDataOffset(zip, jpeg)) < 0) {
+        closeZipSource(src);
+        return NULL;
+    }
+
+    src->rawLeft = jpeg->compressedSize;
+    return src;
+}
+
+// First *size bytes of uncompressed entry data (fewer if it's shorter, new
+// size stored back). Only the compressed bytes needed for them are read,
+// none if compressed data is given in inRaw or the archive is mapped.
+static unsigned char *readEntryHead(JZFile *zip, JPEGRecord *jpeg, const unsigned char *inRaw, long *size) {
+    unsigned char *raw, *data;
+    long n = (long)MIN(*size, jpeg->size), rawSize;
+    Sint64 offset;
+    int ok;
+
+    if(jpeg->method != 0 && jpeg->method != 8)
+        return NULL;
+
+    if((data = (unsigned char *)malloc(n)) == NULL)
+        return NULL;
+
+    if((raw = inRaw ? (unsigned char *)inRaw : mappedEntry(zip, jpeg)) != NULL) {
+        if(jpeg->method == 0)
+            memcpy(data, raw, n);
+        else if(inflateBuffer(raw, jpeg->compressedSize, data, n) != Z_OK) {
+            free(data);
+            return NULL;
+        }
+        *size = n;
+        return data;
+    }
+
+    // Deflate can't grow JPEG data much, stored blocks add 5 bytes per 16k
+    rawSize = (jpeg->method == 0) ? n : (long)MIN(jpeg->compressedSize, n + n / 1024 + 64);
+    if((raw = (unsigned char *)malloc(rawSize)) == NULL) {
+        free(data);
+        return NULL;
+    }
+
+    ok = (offset = entryDataOffset(zip, jpeg)) >= 0 &&
+        readArchive(zip, offset, raw, rawSize) == rawSize;
+
+    if(ok && jpeg->method == 0)
+        memcpy(data, raw, n);
+    else if(ok)
+        ok = (inflateBuffer(raw, rawSize, data, n) == Z_OK);
+
+    free(raw);
+
+    if(!ok) {
+        free(data);
+        return NULL;
+    }
+
+    *size = n;
+    return data;
+}
+
+// Get uncompressed data for entry, reading it if not already in memory.
+// Data is either pinned in cache (*item set), owned by caller (*owned set)
+// or neither when used in place from a mapped archive.
+static unsigned char *getEntryData(JZFile *zip, JPEGRecord *jpeg,
+        JMemCacheItem **item, int *owned, JLoadTimes *times) {
+    unsigned char *data;
+
+    *item = NULL;
+    *owned = 0;
+
+    if(jpeg->method == 0 && (data = mappedEntry(zip, jpeg)) != NULL)
+        return data; // stored in mapped archive, use in place
+
+    if(dataCache != NULL && (*item = memcache_get(dataCache, jpeg, MEMCACHE_DATA)) != NULL)
+        return (unsigned char *)(*item)->object;
+
+    if((data = readEntryData(zip, jpeg, times)) == NULL)
+        return NULL;
+
+    if(dataCache != NULL && (*item = memcache_put(dataCache, jpeg, MEMCACHE_DATA, data, jpeg->size)) != NULL)
+        return (unsigned char *)(*item)->object; // may differ if someone was faster
+
+    *owned = 1;
+    return data;
+}
+
+JImage *loadImageFromZip(JZFile *zip, JPEGRecord *jpeg, int destx, int desty) {
+    return loadImageTimed(zip, jpeg, destx, desty, NULL);
+}
+
+// Decode from src and close it
+static JImage *decodeStream(JZipSource *src, int destx, int desty, JLoadTimes *times, int *orientation) {
+    Uint64 span = trace_start();
+    JLoadTimes stream;
+    JImage *image;
+
+    memset(&stream, 0, sizeof(stream));
+    image = decodeJPEG(NULL, 0, &src->pub, destx, desty, &stream, NULL, NULL, orientation, destx && desty);
+    trace_end("decode", span); // reads and inflates nested in it
+
+    if(src->error && image != NULL) { // cut short by a bad read
+        destroy_image(image);
+        image = NULL;
+    }
+
+    if(times != NULL) { // decode time includes reading and inflating
+        times->read += src->times.read;
+        times->inflate += src->times.inflate;
+        times->decode += stream.decode - src->times.read - src->times.inflate;
+        times->convert += stream.convert;
+    }
+
+    closeZipSource(src);
+
+    return image;
+}
+
+// Apply EXIF orientation to image, replacing it
+static JImage *orientLoaded(JImage *image, int orientation) {
+    Uint64 span;
+    JImage *t;
+
+    if(image == NULL || orientation <= 1)
+        return image;
+
+    span = trace_start();
+    if((t = create_image(image->w, image->h)) != NULL) // same pixels, w and h are set below
+        orient_image(t, image, orientation);
+    destroy_image(image);
+    trace_end("orient", span);
+
+    return t;
+}
+
+// Stretch/shrink to fit destx x desty unless they are zero, and turn by
+// orientation. Turning after scaling is cheap, the image is small by then.
+static JImage *scaleLoaded(JImage *image, int destx, int desty, int orientation, JLoadTimes *times) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    JImage *t;
+
+    if(image == NULL)
+        return image;
+
+    if(destx && desty) {
+        if(ORIENT_SWAPS(orientation))
+            t = scale(image, desty, destx);
+        else
+            t = scale(image, destx, desty);
+        destroy_image(image);
+        image = t;
+    }
+
+    image = orientLoaded(image, orientation);
+
+    if(times != NULL) // includes turning
+        times->scale += SDL_GetPerformanceCounter() - start;
+
+    return image;
+}
+
+JImage *loadImageTimed(JZFile *zip, JPEGRecord *jpeg, int destx, int desty, JLoadTimes *times) {
+    JImage *image = NULL;
+    JMemCacheItem *item = NULL;
+    JZipSource *src;
+    unsigned char *data = NULL;
+    int orientation = 1;
+
+    // Data already in memory is decoded in place, anything else is streamed
+    // from the archive into the decoder without keeping it around
+    if(jpeg->method == 0)
+        data = mappedEntry(zip, jpeg);
+    if(data == NULL && dataCache != NULL && (item = memcache_get(dataCache, jpeg, MEMCACHE_DATA)) != NULL)
+        data = (unsigned char *)item->object;
+
+    if(data != NULL) {
+        image = decodeBuffer(data, jpeg->size, destx, desty, times, &orientation, destx && desty);
+        memcache_release(dataCache, item);
+    } else if((src = openZipSource(zip, jpeg, NULL)) != NULL)
+        image = decodeStream(src, destx, desty, times, &orientation);
+
+    return scaleLoaded(image, destx, desty, orientation, times);
+}
+
+JImage *loadImageFromRaw(JPEGRecord *jpeg, const unsigned char *raw, int destx, int desty, JLoadTimes *times) {
+    JImage *image = NULL;
+    JZipSource *src;
+    int orientation = 1;
+
+    if(jpeg->method == 0)
+        image = decodeBuffer((unsigned char *)raw, jpeg->size, destx, desty, times, &orientation, destx && desty);
+    else if((src = openZipSource(NULL, jpeg, raw)) != NULL)
+        image = decodeStream(src, destx, desty, times, &orientation);
+
+    return scaleLoaded(image, destx, desty, orientation, times);
+}
+
+// Enough for APP0 and the start of APP1, the rest is read if needed
+#define EXIF_HEAD 4096
+
+// From archive, or compressed data in raw if it's not NULL
+static JImage *exifThumb(JZFile *zip, JPEGRecord *jpeg, const unsigned char *raw, int w, int h) {
+    JImage *thumb, *image = NULL;
+    JMemCacheItem *item = NULL;
+    unsigned char *data = NULL;
+    long size = jpeg->size, need, offset, length;
+    int owned = 0, orientation, t;
+
+    // Whole data is free to look at if it's already in memory
+    if(dataCache != NULL && (item = memcache_get(dataCache, jpeg, MEMCACHE_DATA)) != NULL)
+        data = (unsigned char *)item->object;
+    else if(jpeg->method == 0 && (data = raw ? (unsigned char *)raw : mappedEntry(zip, jpeg)) != NULL)
+        ; // used in place
+    else {
+        size = EXIF_HEAD;
+        owned = 1;
+        if((data = readEntryHead(zip, jpeg, raw, &size)) == NULL)
+            return NULL;
+        if((need = exif_thumbnail(data, size, &offset, &length)) > size) {
+            free(data); // EXIF is bigger, thumbnail is usually at its end
+            size = need;
+            data = readEntryHead(zip, jpeg, raw, &size);
+        }
+    }
+
+    if(data != NULL && exif_thumbnail(data, size, &offset, &length) == 0 &&
+            (thumb = decodeBuffer(data + offset, length, 0, 0, NULL, NULL, 1)) != NULL) {
+        // Thumbnail is stored as is, the main image's orientation applies
+        if(ORIENT_SWAPS(orientation = exif_orientation(data, size)))
+            SWAP(w, h, t);
+        if(thumb->w >= w || thumb->h >= h) // no upscaling, that would look worse
+            image = orientLoaded(scale(thumb, w, h), orientation);
+        destroy_image(thumb);
+    }
+
+    if(owned)
+        free(data);
+    else
+        memcache_release(dataCache, item);
+
+    return image;
+}
+
+JImage *loadExifThumbFromZip(JZFile *zip, JPEGRecord *jpeg, int w, int h) {
+    return exifThumb(zip, jpeg, NULL, w, h);
+}
+
+JImage *loadExifThumbFromRaw(JPEGRecord *jpeg, const unsigned char *raw, int w, int h) {
+    return exifThumb(NULL, jpeg, raw, w, h);
+}
+
+JImage *loadPreviewFromZip(JZFile *zip, JPEGRecord *jpeg, int *fullW, int *fullH, int *orientation) {
+    JImage *image;
+    JMemCacheItem *item;
+    unsigned char *data;
+    Uint64 span;
+    int owned, turn = 1, t;
+
+    if((data = getEntryData(zip, jpeg, &item, &owned, NULL)) == NULL)
+        return NULL;
+
+    span = trace_start();
+    image = decodeJPEG(data, jpeg->size, NULL, 1, 1, NULL, fullW, fullH, &turn, 0); // 1x1 target gives 1/8
+    trace_end("decode preview", span);
+
+    if((image = orientLoaded(image, turn)) != NULL && ORIENT_SWAPS(turn))
+        SWAP(*fullW, *fullH, t);
+    if(orientation != NULL)
+        *orientation = turn;
+
+    if(owned)
+        free(data);
+    else
+        memcache_release(dataCache, item);
+
+    return image;
+}
+
+JImage *loadRegionFromZip(JZFile *zip, JPEGRecord *jpeg, int level, int x, int y, int w, int h) {
+    JImage *image;
+    JMemCacheItem *item;
+    unsigned char *data;
+    Uint64 span;
+    int owned;
+
+    if((data = getEntryData(zip, jpeg, &item, &owned, NULL)) == NULL)
+        return NULL;
+
+    span = trace_start();
+    image = decodeRegion(data, jpeg->size, level, x, y, w, h);
+    trace_end("decode region", span);
+
+    if(owned)
+        free(data);
+    else
+        memcache_release(dataCache, item);
+
+    return image;
+}
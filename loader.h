@@ -0,0 +1,113 @@
+/**
+ * Image loading from ZIP entries.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __LOADER_H
+#define __LOADER_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+#include "junzip.h"
+#include "memcache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// No pointers, so an array of these can be mapped from a file, see zipindex.h
+typedef struct {
+    Sint64 offset; // of local header, ZIP64 archives go past 4 GB
+    Sint64 size, compressedSize;
+    Uint32 crc;
+    Uint32 name; // filename offset in JZipIndex names
+    Uint16 nameLength;
+    Uint16 method; // 0 = stored, 8 = deflated
+    Uint8 failed; // MEMCACHE_BIT of each kind that couldn't be loaded, not retried
+    Uint8 queued; // MEMCACHE_BIT of each kind being loaded in worker pool
+    Uint16 archive; // in JCatalog, see catalog.h
+} JPEGRecord;
+
+// Time spent in each loading stage, in SDL performance counter ticks
+typedef struct {
+    Uint64 read, inflate, decode, convert, scale;
+} JLoadTimes;
+
+// Must be called once before any loads, and before worker threads start.
+// Uncompressed entry data is kept in cache if it's not NULL.
+void init_loader(JMemCache *cache);
+
+void quit_loader(void);
+
+// Scale to fit given max size (w/h), keeping aspect ratio
+JImage *scale(JImage *image, int w, int h);
+
+// Decode JPEG, using DCT scaling to get close to tx * ty if both nonzero
+JImage *read_JPEG_custom(unsigned char *inbuffer, unsigned long insize,
+        int tx, int ty);
+
+// Same as above, adding decode and pixel conversion times to *times
+JImage *read_JPEG_timed(unsigned char *inbuffer, unsigned long insize,
+        int tx, int ty, JLoadTimes *times);
+
+// Thread safe read of archive bytes at offset, returns bytes read
+long readArchive(JZFile *zip, Sint64 offset, unsigned char *buf, long size);
+
+// Compressed data of entry in buf, which holds archive bytes from bufOffset
+// on. NULL if it's not all there.
+const unsigned char *findEntryData(const unsigned char *buf, size_t size, Sint64 bufOffset, JPEGRecord *jpeg);
+
+// Read and uncompress entry data, returns malloc'd buffer of jpeg->size bytes
+unsigned char *readEntryData(JZFile *zip, JPEGRecord *jpeg, JLoadTimes *times);
+
+// Thread safe, returns NULL on errors. destx = desty = 0 means full size.
+// Entry data is inflated into the decoder as it goes, unless it's already
+// in memory (memory cache or stored in a mapped archive).
+JImage *loadImageFromZip(JZFile *zip, JPEGRecord *jpeg, int destx, int desty);
+
+// Same as above, times may be NULL
+JImage *loadImageTimed(JZFile *zip, JPEGRecord *jpeg, int destx, int desty, JLoadTimes *times);
+
+// Like loadImageTimed() from compressed entry data already in memory
+JImage *loadImageFromRaw(JPEGRecord *jpeg, const unsigned char *raw, int destx, int desty, JLoadTimes *times);
+
+// Thumbnail embedded in EXIF data scaled to fit w x h, reading only the
+// start of the entry. NULL if there's none or it would need upscaling,
+// use loadImageFromZip() then. Thread safe.
+JImage *loadExifThumbFromZip(JZFile *zip, JPEGRecord *jpeg, int w, int h);
+
+// Like loadExifThumbFromZip() from compressed entry data already in memory
+JImage *loadExifThumbFromRaw(JPEGRecord *jpeg, const unsigned char *raw, int w, int h);
+
+// Quick 1/8 scale decode for showing something while the real load runs,
+// turned by EXIF orientation. Full resolution size as shown is stored to
+// fullW and fullH, and the orientation to orientation unless it's NULL.
+// Thread safe.
+JImage *loadPreviewFromZip(JZFile *zip, JPEGRecord *jpeg, int *fullW, int *fullH, int *orientation);
+
+// Decode w * h region at (x, y) of the image scaled to 1 / 2^level (0-3).
+// Coordinates are in scaled pixels. Thread safe, returns NULL on errors.
+JImage *loadRegionFromZip(JZFile *zip, JPEGRecord *jpeg, int level, int x, int y, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -48,21 +48,41 @@
 #include "image.h"
 #include "font.h"
 #include "junzip.h"
+#include "loader.h"
+#include "mapfile.h"
+#include "pool.h"
+#include "thumbcache.h"
+#include "memcache.h"
+#include "prefetch.h"
+#include "tiles.h"
+#include "dirty.h"
+#include "texview.h"
+#include "bench.h"
+#include "hud.h"
+#include "trace.h"
+#include "catalog.h"
+#include "zipindex.h"
+#include "slab.h"
 
 #define THUMB_W 400
 #define THUMB_H 400
 
-typedef struct {
-    char *filename;
-    long offset;
-    long size, compressedSize;
-    unsigned char *data;
-    JImage *thumbnail;
-    int loaded;
-} JPEGRecord;
+// In JPEGRecord.queued next to MEMCACHE_BITs: cached thumbnail was scaled up
+// from a smaller cell size, decode a sharp one when there's time
+#define THUMB_UPSCALED MEMCACHE_BIT(MEMCACHE_KINDS)
 
-JPEGRecord *jpegs;
-int jpeg_count, thumbsLeft = 0;
+JCatalog *catalog;
+int jpeg_count, thumbsLeft = 0; // thumbsLeft: grid may still need loading
+JMemCache *memCache;
+
+// What drawThumbs() left in each grid cell: image index * CELL_STATES + state
+#define CELL_THUMB 0
+#define CELL_WAITING 1
+#define CELL_FAILED 2
+#define CELL_STATES 3
+#define CELL_EMPTY -1 // past the last image
+#define CELL_UNKNOWN -2 // needs drawing
+int *gridShown = NULL, gridCells = 0, gridTop = -1; // gridTop -1: screen has no grid
 
 SDL_Window *window = NULL;
 
@@ -79,273 +99,244 @@ static void writeMessage(int flags, char *title, char *format, ...) {
     va_start(args, format);
     vsprintf(message, format, args);
     va_end(args);
-    SDL_ShowSimpleMessageBox(flags, title, message, window);
+    if(SDL_ShowSimpleMessageBox(flags, title, message, window)) // e.g. headless
+        fprintf(stderr, "%s: %s\n", title, message);
 }
 
-// fixed point scaling with bilinear filter to given max size (w/h)
-JImage *scale(JImage *image, int w, int h) {
-    JImage *res;
-    int i, j, xp, yp, w2, h2, xpart, ypart;
-    int ox, oy, step; // 22.10 fixed point
-    int r, g, b;
-
-    if(w * image->h > image->w * h) { // screen is wider
-        step = 1024 * image->h / h;
-        w2 = image->w * h / image->h;
-        h2 = h;
-    } else { // screen is higher
-        step = 1024 * image->w / w;
-        w2 = w;
-        h2 = image->h * w / image->w;
-    }
+// Caseless comparison of haystack end to lowercase needle
+int matchExtension(const char *haystack, const char *needle) {
+    const char *stack = haystack + strlen(haystack) - strlen(needle);
 
-    if((res = create_image(w2, h2)) == NULL) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't allocate memory for scaled image!\n");
-        quit(1);
-    }
+    if(stack < haystack)
+        return 0;
 
-    for(j=0, oy=0; j<h2; j++, oy+=step) {
-        yp = oy >> 10;
-        ypart = oy & 1023;
-        if(yp + 1 >= image->h) break;
-
-        for(i=0, ox=0; i<w2; i++, ox+=step) {
-            xp = ox >> 10;
-            xpart = ox & 1023;
-            if(xp + 1 >= image->w) break;
-
-            r = ((1024-xpart) * (1024-ypart) * GETR(GETPIXEL(image, xp, yp)) +
-                 (xpart) * (1024-ypart) * GETR(GETPIXEL(image, xp+1, yp)) +
-                 (1024-xpart) * (ypart) * GETR(GETPIXEL(image, xp, yp+1)) +
-                 (xpart) * (ypart) * GETR(GETPIXEL(image, xp+1, yp+1))) >> 20;
-            g = ((1024-xpart) * (1024-ypart) * GETG(GETPIXEL(image, xp, yp)) +
-                 (xpart) * (1024-ypart) * GETG(GETPIXEL(image, xp+1, yp)) +
-                 (1024-xpart) * (ypart) * GETG(GETPIXEL(image, xp, yp+1)) +
-                 (xpart) * (ypart) * GETG(GETPIXEL(image, xp+1, yp+1))) >> 20;
-            b = ((1024-xpart) * (1024-ypart) * GETB(GETPIXEL(image, xp, yp)) +
-                 (xpart) * (1024-ypart) * GETB(GETPIXEL(image, xp+1, yp)) +
-                 (1024-xpart) * (ypart) * GETB(GETPIXEL(image, xp, yp+1)) +
-                 (xpart) * (ypart) * GETB(GETPIXEL(image, xp+1, yp+1))) >> 20;
-
-            res->data[j * res->w + i] = GETRGB(r,g,b);
-        }
-    }
+    for(; *needle; stack++, needle++)
+        if(tolower(*stack) != *needle)
+            return 0;
 
-    return res;
+    return 1;
 }
 
-// Poor man's error handling, thanks JPEGLIB for ZERO documentation
-int jpegError = 0;
-void error_exit(j_common_ptr cinfo) { jpegError = 1; }
-
-JImage *read_JPEG_custom(unsigned char *inbuffer, unsigned long insize,
-        int tx, int ty) {
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-
-    JSAMPARRAY buffer;      /* Output row buffer */
-    int row_stride, x, y;     /* physical row width in output buffer */
-    JImage *image = NULL;
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jerr.error_exit = error_exit; // catch errors and skip instead of exiting
-    jpegError = 0; // reset possible error state
+static int isJPEG(const char *filename) {
+    return matchExtension(filename, ".jpg") || matchExtension(filename, ".jpeg");
+}
 
-    jpeg_create_decompress(&cinfo);
-    if(jpegError) goto READ_ERROR;
+// Index JPEGs of archives (and ZIPs in directories) from central directory
+// or sidecar index. With ZIPINDEX_BACKGROUND jpeg_count grows as parsing
+// goes on.
+int processZips(char **paths, int count, int options, long long thumbLimit) {
+    if((catalog = create_catalog(paths, count, options, isJPEG, thumbLimit)) == NULL) {
+        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't read any ZIP file central directory.");
+        return -1;
+    }
 
-    jpeg_mem_src(&cinfo, inbuffer, insize);
-    if(jpegError) goto READ_ERROR_DESTROY;
+    jpeg_count = catalog_update(catalog);
 
-    jpeg_read_header(&cinfo, TRUE);
-    if(jpegError) goto READ_ERROR_DESTROY;
+    return 0;
+}
 
-    cinfo.out_color_space = JCS_RGB; // make RGB even from greyscale
-    cinfo.dct_method = JDCT_ISLOW; // best quality, not really slower than IFAST or FLOAT
+void drawImage(JImage *screen, JImage *image, int xoff, int yoff) {
+    Uint64 span = trace_start();
+    int dx = 0, dy = 0;
 
-    if(tx && ty) {
-        if(cinfo.image_width / 8 > tx || cinfo.image_height / 8 > ty)
-            cinfo.scale_num = 1;
-        else if(cinfo.image_width / 4 > tx || cinfo.image_height / 4 > ty)
-            cinfo.scale_num = 2;
-        else if(cinfo.image_width / 2 > tx || cinfo.image_height / 2 > ty)
-            cinfo.scale_num = 4;
-    }
+    if(screen->w > image->w) // center if fits
+        dx = (screen->w - image->w) / 2;
 
-    jpeg_start_decompress(&cinfo);
-    if(jpegError) goto READ_ERROR_FINISH;
+    if(screen->h > image->h) // center if fits
+        dy = (screen->h - image->h) / 2;
 
-    row_stride = cinfo.output_width * cinfo.output_components;
+    if(dx || dy)
+        fill_image(screen, 0);
 
-    /* Make a one-row-high sample array that will go away when done with image */
-    buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
-    if(jpegError) goto READ_ERROR_FINISH;
+    blit_image(screen, dx, dy, image, xoff, yoff, image->w, image->h);
+    trace_end("blit", span);
+}
 
-    if((image = create_image(cinfo.output_width, cinfo.output_height)) == NULL) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't allocate memory for scaled image!\n");
-        quit(1);
-    }
+// Texture tiles are for one image, start over when it changes
+JTexView *viewFor(JTexView *view, SDL_Renderer *renderer, const void *source, int w, int h, int shift) {
+    if(view != NULL && view->source == source && view->w == w && view->h == h)
+        return view;
 
-    for(y=0; cinfo.output_scanline < cinfo.output_height; y++) {
-        jpeg_read_scanlines(&cinfo, buffer, 1);
-        if(jpegError) goto READ_ERROR_FINISH;
-        for(x=0; x<image->w; x++)
-            image->data[image->w * y + x] = GETRGB(buffer[0][x*3+0],
-                        buffer[0][x*3+1], buffer[0][x*3+2]);
-    }
+    if(view != NULL)
+        destroy_texview(view);
 
-READ_ERROR_FINISH:
-    jpeg_finish_decompress(&cinfo);
-READ_ERROR_DESTROY:
-    jpeg_destroy_decompress(&cinfo);
-READ_ERROR:
-    return image;
+    return create_texview(renderer, source, w, h, shift, TEXVIEW_TILE);
 }
 
-JImage *loadImageFromZip(JZFile *zip, JPEGRecord *jpeg, int destx, int desty) {
-    JZFileHeader header = {0};
-    JImage *image = NULL, *t;
+// Fullsize view straight from textures, panning only changes rectangles
+void renderView(JTexView *view, JImage *img, int fullW, int fullH, int sw, int sh, int mousex, int mousey) {
+    int vw = MIN(sw, fullW), vh = MIN(sh, fullH);
+    int xoff = (fullW - vw) * mousex / sw, yoff = (fullH - vh) * mousey / sh;
+    Uint64 span = trace_start();
 
-    if(jpeg->data == NULL) {
-        header.compressedSize = jpeg->compressedSize;
-        header.uncompressedSize = jpeg->size;
-
-        if(zip->seek(zip, jpeg->offset, SEEK_SET)) {
-            writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't seek to local file header!");
-            quit(1);
-        }
+    texview_upload(view, img, xoff, yoff, vw, vh);
+    trace_end("upload", span);
+    texview_render(view, xoff, yoff, vw, vh, (sw - vw) / 2, (sh - vh) / 2); // center if fits
+}
 
-        if(jzReadLocalFileHeader(zip, &header, NULL, 0)) { // don't re-read filename
-            writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't read local file header!");
-            quit(1);
-        }
+// Drop queued full size loads, they are for images we no longer show
+void cancelFullsize(JPool *pool) {
+    JLoadJob *job, *list = pool_cancel(pool, MEMCACHE_FULLSIZE);
 
-        if((jpeg->data = (unsigned char *)malloc(jpeg->size)) == NULL) {
-            writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't allocate memory!");
-            quit(1);
-        }
+    for(job = list; job != NULL; job = job->next)
+        job->jpeg->queued &= ~MEMCACHE_BIT(MEMCACHE_FULLSIZE);
 
-        if(jzReadData(zip, &header, jpeg->data) != Z_OK) {
-            writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't read/uncompress JPEG!");
-            quit(1);
-        }
-    }
+    destroy_jobs(list);
+}
 
-    image = read_JPEG_custom(jpeg->data, jpeg->size, destx, desty);
+// Move grid pixels by rows of cells, up if positive, exposed cells are unknown
+void scrollThumbs(JImage *screen, int tx, int ty, int rows) {
+    size_t row = (size_t)(screen->h / ty) * screen->w; // pixels in a row of cells
+    int keep = ty - abs(rows), k;
 
-    if(image != NULL && destx && desty) { // stretch/shrink
-        t = scale(image, destx, desty);
-        destroy_image(image);
-        image = t;
+    if(rows > 0) {
+        memmove(screen->data, screen->data + rows * row, keep * row * sizeof(Uint32));
+        memmove(gridShown, gridShown + rows * tx, keep * tx * sizeof(int));
+        for(k = keep * tx; k < tx * ty; k++)
+            gridShown[k] = CELL_UNKNOWN;
+    } else {
+        memmove(screen->data - rows * row, screen->data, keep * row * sizeof(Uint32));
+        memmove(gridShown - rows * tx, gridShown, keep * tx * sizeof(int));
+        for(k = 0; k < -rows * tx; k++)
+            gridShown[k] = CELL_UNKNOWN;
     }
-
-    return image;
 }
 
-// Caseless comparison of haystack end to lowercase needle
-int matchExtension(const char *haystack, const char *needle) {
-    const char *stack = haystack + strlen(haystack) - strlen(needle);
+// Pinned thumbnail for a w x h cell or NULL. Ones cached for another cell
+// size (before a resize) are rescaled, which is much faster than decoding
+// them again. Only the cells in view are done, the rest as they come up.
+static JMemCacheItem *cellThumb(JPEGRecord *jpeg, int w, int h) {
+    JMemCacheItem *item = memcache_get(memCache, jpeg, MEMCACHE_THUMB);
+    JImage *old, *thumb;
 
-    if(stack < haystack)
-        return 0;
+    if(item == NULL)
+        return NULL;
 
-    for(; *needle; stack++, needle++)
-        if(tolower(*stack) != *needle)
-            return 0;
+    old = (JImage *)item->object;
+    if((old->w == w && old->h <= h) || (old->h == h && old->w <= w))
+        return item; // made for this size
 
-    return 1;
-}
+    thumb = scale(old, w, h);
+    memcache_release(memCache, item);
+    if(thumb == NULL)
+        return NULL;
 
-// Check individual file if it's a jpeg and store data for it if it is
-int recordCallback(JZFile *zip, int idx, JZFileHeader *header, char *filename, void *user_data) {
-    JPEGRecord *jpeg = &jpegs[jpeg_count];
-    (void)zip;
-    (void)idx;
-    (void)user_data;
-
-    if(!matchExtension(filename, ".jpg") && !matchExtension(filename, ".jpeg"))
-        return 1; // skip
-
-    jpeg->offset = header->offset;
-    jpeg->size = header->uncompressedSize;
-    jpeg->compressedSize = header->compressedSize;
-    jpeg->data = NULL;
-    jpeg->thumbnail = NULL;
-    jpeg->loaded = 0;
-    jpeg->filename = (char *)malloc(strlen(filename)+1);
-
-    if(jpeg->filename == NULL) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't allocate space for filename!\n");
-        quit(1);
+    if(thumb->w > old->w || thumb->h > old->h) { // blurry, load properly later
+        jpeg->queued |= THUMB_UPSCALED;
+        thumbsLeft = 1;
     }
 
-    strcpy(jpeg->filename, filename); // store filename
-    jpeg_count++;
+    memcache_remove(memCache, jpeg, MEMCACHE_THUMB);
+    if((item = memcache_put_image(memCache, jpeg, MEMCACHE_THUMB, thumb)) == NULL)
+        destroy_image(thumb);
 
-    return 1; // continue
+    return item;
 }
 
-// Process zip central directory and allocate room for jpegs
-int processZip(JZFile *zip) {
-    JZEndRecord endRecord;
-
-    if(jzReadEndRecord(zip, &endRecord)) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't read ZIP file end record.");
-        return -1;
+// Redraws cells that changed since last call, adding them to dirty
+void drawThumbs(JImage *screen, JFont *font, int tx, int ty, int topleft, JDirty *dirty) {
+    JMemCacheItem *thumb;
+    int tw = screen->w / tx, th = screen->h / ty;
+    int i, j, k, idx, shown, *cells;
+    Uint64 span;
+    char num[12];
+
+    if(gridTop < 0 || gridCells != tx * ty) { // start from scratch
+        if((cells = (int *)realloc(gridShown, tx * ty * sizeof(int))) == NULL)
+            return;
+        gridShown = cells;
+        gridCells = tx * ty;
+        for(k = 0; k < gridCells; k++)
+            gridShown[k] = CELL_UNKNOWN;
+        fill_image(screen, 0); // margins right and below the grid
+        dirty_all(dirty, screen);
+    } else if(topleft != gridTop) { // scrolled, reuse rows still in view
+        if((topleft - gridTop) % tx == 0 && abs(topleft - gridTop) / tx < ty)
+            scrollThumbs(screen, tx, ty, (topleft - gridTop) / tx);
+        else for(k = 0; k < gridCells; k++)
+            gridShown[k] = CELL_UNKNOWN;
+        dirty_add(dirty, 0, 0, tw * tx, th * ty);
     }
+    gridTop = topleft;
 
-    jpegs = (JPEGRecord *)malloc(sizeof(JPEGRecord) * endRecord.numEntries);
-    jpeg_count = 0;
+    for(j = 0; j < ty; j++) {
+        for(i = 0; i < tx; i++) {
+            k = j * tx + i;
+            idx = topleft + k;
+            thumb = NULL;
 
-    if(jzReadCentralDirectory(zip, &endRecord, recordCallback, NULL)) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't read ZIP file central record.");
-        return -1;
+            if(idx >= jpeg_count)
+                shown = CELL_EMPTY;
+            else if((thumb = cellThumb(catalog_entry(catalog, idx), tw, th)) != NULL)
+                shown = idx * CELL_STATES + CELL_THUMB;
+            else
+                shown = idx * CELL_STATES + ((catalog_entry(catalog, idx)->failed & MEMCACHE_BIT(MEMCACHE_THUMB)) ? CELL_FAILED : CELL_WAITING);
+
+            if(shown != gridShown[k]) {
+                fill_rect(screen, tw * i, th * j, tw, th,
+                        (shown >= 0 && shown % CELL_STATES == CELL_WAITING) ? GETRGB(80,0,0) : 0);
+                if(thumb != NULL) {
+                    trace_entry(catalog_entry(catalog, idx), tw, th);
+                    span = trace_start();
+                    blit_sprite(screen, tw * i, th * j, (JImage *)thumb->object);
+                    trace_end("blit", span);
+                } else if(idx < jpeg_count) {
+                    sprintf(num, "%d", idx + 1);
+                    write_font(screen, font, 0xFFFFFF, num,
+                            tw * i + tw / 2,
+                            th * j + th / 2,
+                            FONT_ALIGN_MIDDLE + FONT_ALIGN_CENTER, 2);
+                }
+                dirty_add(dirty, tw * i, th * j, tw, th);
+                gridShown[k] = shown;
+            }
+
+            memcache_release(memCache, thumb);
+        }
     }
 
-    return 0;
+    trace_entry(NULL, 0, 0);
 }
 
-void drawImage(JImage *screen, JImage *image, int xoff, int yoff) {
-    int dx = 0, dy = 0;
+// Get image from memory cache or load it there, returns pinned item or NULL
+JMemCacheItem *loadCached(JPEGRecord *jpeg, int kind, int w, int h) {
+    JMemCacheItem *item;
+    JImage *image = NULL;
+    JZFile *zip;
 
-    if(screen->w > image->w) // center if fits
-        dx = (screen->w - image->w) / 2;
+    if((item = memcache_get(memCache, jpeg, kind)) != NULL)
+        return item;
 
-    if(screen->h > image->h) // center if fits
-        dy = (screen->h - image->h) / 2;
+    if((zip = catalog_open(catalog, jpeg)) != NULL) {
+        trace_entry(jpeg, w, h);
+        image = loadImageFromZip(zip, jpeg, w, h);
+        trace_entry(NULL, 0, 0);
+        catalog_release(catalog, jpeg);
+    }
 
-    if(dx || dy)
-        fill_image(screen, 0);
+    if(image == NULL)
+        return NULL;
 
-    blit_image(screen, dx, dy, image, xoff, yoff, image->w, image->h);
+    if((item = memcache_put_image(memCache, jpeg, kind, image)) == NULL)
+        destroy_image(image);
+
+    return item;
 }
 
-void drawThumbs(JImage *screen, JFont *font, int tx, int ty, int topleft) {
-    JImage *thumb;
-    int tw = screen->w / tx, th = screen->h / ty;
-    int i, j, idx;
-    char num[6];
+// See loadPreviewFromZip(), NULL if archive can't be opened
+JImage *loadPreview(JPEGRecord *jpeg, int *fullW, int *fullH, int *orientation) {
+    JImage *image;
+    JZFile *zip;
 
-    fill_image(screen, thumbsLeft ? GETRGB(80,0,0) : 0);
+    if((zip = catalog_open(catalog, jpeg)) == NULL)
+        return NULL;
 
-    for(j = 0; j < ty; j++) {
-        for(i = 0; i < tx; i++) {
-            idx = topleft + j * tx + i;
+    trace_entry(jpeg, 0, 0);
+    image = loadPreviewFromZip(zip, jpeg, fullW, fullH, orientation);
+    trace_entry(NULL, 0, 0);
+    catalog_release(catalog, jpeg);
 
-            if(idx >= jpeg_count)
-                break; // done
-
-            if((thumb = jpegs[idx].thumbnail)) {
-                blit_sprite(screen, tw * i, th * j, thumb);
-            } else {
-                sprintf(num, "%d", idx + 1);
-                write_font(screen, font, 0xFFFFFF, num,
-                        tw * i + tw / 2,
-                        th * j + th / 2,
-                        FONT_ALIGN_MIDDLE + FONT_ALIGN_CENTER, 2);
-            }
-        }
-    }
+    return image;
 }
 
 int main(int argc, char *argv[]) {
@@ -354,44 +345,131 @@ int main(int argc, char *argv[]) {
     JImage *screen;
     JFont *font24;
     int x, y;
-    char fontname[1024];
-    FILE *zipFile;
-    JZFile *zip;
+    char fontname[1024], **paths, *tracePath = NULL;
     JPEGRecord *jpeg;
+    JPool *pool;
+    JPrefetch *prefetch;
+    JTiledImage *tiled = NULL; // huge image in fullsize mode
+    JLoadJob *job;
+    JMemCacheItem *item;
+    JDirty dirty;
+    JHud *hud = NULL;
     SDL_Event event;
     int done = 0, redraw = 1, tx = 8, ty = 5, i, j, mousex = 0, mousey = 0,
         currentImage = 0, earlierImage = 0, loadedFullscreen = -1, loadedFullsize = -1;
-    JImage *fullscreen = NULL, *fullsize = NULL;
+    JMemCacheItem *fullscreenItem = NULL, *fullsizeItem = NULL;
+    JImage *fullscreen = NULL, *fullsize = NULL, *preview = NULL, *fit;
+    JTexView *fullView = NULL, *previewView = NULL; // uploaded parts of fullsize and preview
+    int previewIndex = -1, previewW = 0, previewH = 0, previewTurn = 1, xoff, yoff, vw, vh;
     enum { MODE_THUMBS, MODE_FULLSCREEN, MODE_FULLSIZE } mode = MODE_THUMBS;
     int windowed = 0; // Flag for windowed mode
+    int threads = SDL_GetCPUCount(), thumbGeneration = 0, diskCacheMB = 1024;
+    int cacheMB = 512, cacheStats = 0, prefetchAhead = 4, pathCount = 0;
+    int bench = 0, showHud = 0, present = 0, framed, hugePages = 0;
+    JBenchConfig benchConfig = { NULL, 0, THUMB_W, THUMB_H, 0, 0, 0, 0.0, 0, 0 };
+    Uint64 benchStart, frameStart, span;
 
 #ifdef LOGFILE
     logfile = fopen(LOGFILE, "wt");
 #endif
 
+    if(argc >= 2 && strcmp(argv[1], "--bench-scale") == 0) // no archive needed
+        return run_scale_bench(argc >= 3 && strcmp(argv[2], "--json") == 0);
+    if(argc >= 2 && strcmp(argv[1], "--bench-image") == 0)
+        return run_image_bench(argc >= 3 && strcmp(argv[2], "--json") == 0);
+
     // Check for command line arguments
     if(argc < 2) {
-        writeMessage(SDL_MESSAGEBOX_INFORMATION, "Usage", "jzipview <pictures.zip> [--windowed]");
+        writeMessage(SDL_MESSAGEBOX_INFORMATION, "Usage", "jzipview <pictures.zip|dir>... [--windowed] [--threads N] [--cache-mb N] [--cache-stats] [--disk-cache-mb N] [--prefetch N] [--hud] [--trace out.json] [--huge-pages]\n"
+                "jzipview <pictures.zip|dir>... --bench [--size WxH] [--exif] [--json] [--threads N] [--trace out.json] [--huge-pages]\n"
+                "jzipview --bench-scale [--json]\n"
+                "jzipview --bench-image [--json]");
         return 0;
     }
     
-    // Parse command line arguments
-    for(i = 2; i < argc; i++) {
+    if((paths = (char **)calloc(argc, sizeof(char *))) == NULL)
+        return 1;
+
+    // Parse command line arguments, everything else is an archive or directory
+    for(i = 1; i < argc; i++) {
         if(strcmp(argv[i], "--windowed") == 0) {
             windowed = 1;
+        } else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cacheMB = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            prefetchAhead = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--cache-stats") == 0) {
+            cacheStats = 1;
+        } else if(strcmp(argv[i], "--hud") == 0) {
+            showHud = 1;
+        } else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if(strcmp(argv[i], "--huge-pages") == 0) {
+            hugePages = 1;
+        } else if(strcmp(argv[i], "--disk-cache-mb") == 0 && i + 1 < argc) {
+            diskCacheMB = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if(sscanf(argv[++i], "%dx%d", &benchConfig.w, &benchConfig.h) != 2)
+                benchConfig.w = benchConfig.h = 0; // full size
+        } else if(strcmp(argv[i], "--json") == 0) {
+            benchConfig.json = 1;
+        } else if(strcmp(argv[i], "--exif") == 0) {
+            benchConfig.exif = 1;
+        } else if(strncmp(argv[i], "--", 2) != 0) {
+            paths[pathCount++] = argv[i];
         }
     }
 
+    if(!pathCount) {
+        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "No ZIP files given!");
+        return -1;
+    }
+
+    // Before any threads, they all record to it
+    if(tracePath != NULL && !init_trace(tracePath))
+        writeMessage(SDL_MESSAGEBOX_WARNING, "Warning", "Couldn't start tracing to \"%s\"", tracePath);
+    trace_thread("main");
+    init_slabs(hugePages);
+
     if(strlen(argv[0]) > 1000) {
         writeMessage(SDL_MESSAGEBOX_WARNING, "Too long path for executable", "Where are you invoking this?");
         return 0;
     }
 
-    if(!(zipFile = fopen(argv[1], "rb"))) {
-        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't open ZIP \"%s\"!", argv[1]);
-        return -1;
+    if(bench) { // headless, no window or font needed
+        SDL_Init(SDL_INIT_TIMER);
+        init_loader(NULL); // each entry is loaded once, caching would not help
+
+        benchStart = SDL_GetPerformanceCounter();
+        if(processZips(paths, pathCount, diskCacheMB > 0 ? ZIPINDEX_SIDECAR : 0, 0)) // every entry is loaded once
+            quit(1);
+        benchConfig.indexTime = (SDL_GetPerformanceCounter() - benchStart) *
+            1000.0 / SDL_GetPerformanceFrequency();
+        benchConfig.indexMapped = 1;
+        for(i = 0; i < catalog->count; i++) {
+            if(catalog->archives[i].index == NULL)
+                continue;
+            benchConfig.indexBytes += zipindex_bytes(catalog->archives[i].index);
+            benchConfig.indexMapped &= catalog->archives[i].index->map != NULL;
+        }
+
+        benchConfig.archive = catalog->archives[0].path;
+        benchConfig.archives = catalog->count;
+        benchConfig.threads = threads;
+        slab_set_size(benchConfig.w, benchConfig.h); // no slabs for full size
+        i = run_bench(catalog, jpeg_count, &benchConfig);
+
+        quit_trace(catalog);
+        destroy_catalog(catalog);
+        free(paths);
+        quit_loader();
+        quit_slabs();
+        quit(i);
     }
-    zip = jzfile_from_stdio_file(zipFile);
 
     strcpy(fontname, argv[0]);
     for(i = strlen(fontname)-1; i; i--) {
@@ -443,62 +521,252 @@ int main(int argc, char *argv[]) {
             SDL_TEXTUREACCESS_STREAMING,
             screen->w, screen->h);
 
-    if(processZip(zip)) {
+    if((memCache = create_memcache((long long)cacheMB << 20)) == NULL) {
+        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't create memory cache!");
         quit(1);
     }
 
-    thumbsLeft = jpeg_count;
+    init_loader(memCache);
+
+    // Sidecar is a disk cache too. Huge archives, or lots of them, can take
+    // long to index, so the grid fills in as entries become known. Thumbnail
+    // cache is optional, we just run slower without it.
+    if(processZips(paths, pathCount, (diskCacheMB > 0 ? ZIPINDEX_SIDECAR : 0) | ZIPINDEX_BACKGROUND,
+                (long long)diskCacheMB << 20)) {
+        quit(1);
+    }
+
+    thumbsLeft = 1;
+
+    if((pool = create_pool(catalog, threads)) == NULL) {
+        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't start loader threads!");
+        quit(1);
+    }
+
+    if((prefetch = create_prefetch(pool, memCache, catalog, jpeg_count, prefetchAhead)) == NULL) {
+        writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't allocate prefetcher!");
+        quit(1);
+    }
+
+    if(showHud && (hud = create_hud(renderer, font24)) == NULL)
+        showHud = 0; // not worth quitting for
 
     // Ensure tx and ty are at least 1 to prevent division by zero
     tx = (screen->w / THUMB_W > 0) ? screen->w / THUMB_W : 1;
     ty = (screen->h / THUMB_H > 0) ? screen->h / THUMB_H : 1;
+    slab_set_size(screen->w / tx, screen->h / ty);
+
+    dirty_clear(&dirty);
 
     // main loop
     while(done < 2) {
+        if(jpeg_count != (i = catalog_update(catalog))) { // more entries parsed
+            jpeg_count = prefetch->count = i;
+            thumbsLeft = 1;
+            if(mode == MODE_THUMBS)
+                redraw = 1; // empty cells may have images now
+        }
+
         if(mode == MODE_FULLSCREEN && loadedFullscreen != currentImage) {
-            if(fullscreen != NULL)
-                destroy_image(fullscreen);
-            fullscreen = loadImageFromZip(zip, jpegs+currentImage, screen->w, screen->h);
-            loadedFullscreen = currentImage;
+            prefetch_update(prefetch, currentImage, screen->w, screen->h, thumbGeneration);
+            jpeg = catalog_entry(catalog, currentImage);
+            if(memcache_contains(memCache, jpeg, MEMCACHE_FULLSCREEN) ||
+                    !(jpeg->queued & MEMCACHE_BIT(MEMCACHE_FULLSCREEN))) {
+                memcache_release(memCache, fullscreenItem); // stays cached for stepping back
+                fullscreenItem = loadCached(jpeg, MEMCACHE_FULLSCREEN, screen->w, screen->h);
+                fullscreen = fullscreenItem ? (JImage *)fullscreenItem->object : NULL;
+                loadedFullscreen = currentImage;
+                redraw = 1;
+            } else if(previewIndex != currentImage) { // coarse version while a worker loads it
+                if(preview != NULL)
+                    destroy_image(preview);
+                preview = loadPreview(jpeg, &previewW, &previewH, &previewTurn);
+                previewIndex = currentImage;
+                redraw = 1;
+            }
         } else if(mode == MODE_FULLSIZE && loadedFullsize != currentImage) {
-            if(fullsize != NULL)
-                destroy_image(fullsize);
-            fullsize = loadImageFromZip(zip, jpegs+currentImage, 0, 0);
-            loadedFullsize = currentImage;
+            jpeg = catalog_entry(catalog, currentImage);
+            if(tiled != NULL) { // for previous image
+                destroy_tiled(tiled);
+                tiled = NULL;
+            }
+            if((item = memcache_get(memCache, jpeg, MEMCACHE_FULLSIZE)) != NULL ||
+                    (jpeg->failed & MEMCACHE_BIT(MEMCACHE_FULLSIZE))) {
+                memcache_release(memCache, fullsizeItem);
+                fullsizeItem = item;
+                fullsize = fullsizeItem ? (JImage *)fullsizeItem->object : NULL;
+                loadedFullsize = currentImage;
+                redraw = 1;
+            } else if(!(jpeg->queued & MEMCACHE_BIT(MEMCACHE_FULLSIZE))) {
+                cancelFullsize(pool); // only the one on screen matters
+                if(previewIndex != currentImage) {
+                    if(preview != NULL)
+                        destroy_image(preview);
+                    preview = loadPreview(jpeg, &previewW, &previewH, &previewTurn);
+                    previewIndex = currentImage;
+                }
+                // Huge images are decoded only where we look, in tiles. Regions
+                // are in stored orientation, so turned ones are decoded whole.
+                if(preview != NULL && previewTurn <= 1 &&
+                        (long long)previewW * previewH > 4LL * screen->w * screen->h &&
+                        (tiled = create_tiled(pool, memCache, jpeg, currentImage,
+                                              preview, previewW, previewH)) != NULL) {
+                    memcache_release(memCache, fullsizeItem);
+                    fullsizeItem = NULL;
+                    fullsize = NULL;
+                    loadedFullsize = currentImage;
+                } else {
+                    pool_submit(pool, currentImage, jpeg, MEMCACHE_FULLSIZE, 0, 0, thumbGeneration);
+                    jpeg->queued |= MEMCACHE_BIT(MEMCACHE_FULLSIZE);
+                }
+                redraw = 1;
+            }
         } else if(thumbsLeft && mode != MODE_FULLSIZE) { // don't load thumbs when in fullsize, too slow
-            for(i = 0; i < jpeg_count; i++) {
+            // Keep queue short so scrolling changes what gets loaded next
+            for(i = 0; i < jpeg_count && pool_pending(pool) < 2 * pool->count; i++) {
+                // Beyond current view, only prefetch while thumbnails take
+                // less than half the budget so they don't evict each other
+                if(i >= tx * ty && memCache->kindBytes[MEMCACHE_THUMB] * 2 >= memCache->limit)
+                    break;
                 j = (currentImage + i) % jpeg_count;
-                jpeg = &jpegs[j];
-                if(jpeg->loaded) continue;
-                jpeg->thumbnail = loadImageFromZip(zip, jpeg, screen->w / tx, screen->h / ty);
-                jpeg->loaded = 1;
-                thumbsLeft--;
-                if(mode == MODE_THUMBS && j >= currentImage && j < currentImage + tx*ty)
+                jpeg = catalog_entry(catalog, j);
+                if(((jpeg->failed | jpeg->queued) & MEMCACHE_BIT(MEMCACHE_THUMB)) ||
+                        (memcache_contains(memCache, jpeg, MEMCACHE_THUMB) && !(jpeg->queued & THUMB_UPSCALED)))
+                    continue;
+                pool_submit(pool, j, jpeg, MEMCACHE_THUMB, screen->w / tx, screen->h / ty, thumbGeneration);
+                jpeg->queued |= MEMCACHE_BIT(MEMCACHE_THUMB);
+            }
+            if(!pool_pending(pool)) // everything we want is there
+                thumbsLeft = 0;
+        }
+
+        while((job = pool_collect(pool)) != NULL) {
+            if(hud != NULL)
+                hud_job(hud, job);
+            if(job->kind == MEMCACHE_FULLSCREEN)
+                prefetch_collect(prefetch, job);
+            else if(job->kind == MEMCACHE_TILE) {
+                if(tiled != NULL && tiled_collect(tiled, job) && mode == MODE_FULLSIZE)
+                    redraw = 1;
+            } else if(job->kind == MEMCACHE_FULLSIZE) {
+                job->jpeg->queued &= ~MEMCACHE_BIT(MEMCACHE_FULLSIZE);
+                if(job->image == NULL)
+                    job->jpeg->failed |= MEMCACHE_BIT(MEMCACHE_FULLSIZE); // thumbnail may still load
+                else if((item = memcache_put_image(memCache, job->jpeg, MEMCACHE_FULLSIZE, job->image)) != NULL) {
+                    job->image = NULL;
+                    if(mode == MODE_FULLSIZE && job->index == currentImage) {
+                        // Take it right away, it may not survive in cache if it's huge
+                        memcache_release(memCache, fullsizeItem);
+                        fullsizeItem = item;
+                        fullsize = (JImage *)item->object;
+                        loadedFullsize = currentImage;
+                        redraw = 1;
+                    } else
+                        memcache_release(memCache, item);
+                }
+            } else if(job->generation == thumbGeneration) { // not from before a resize
+                jpeg = job->jpeg;
+                jpeg->queued &= ~MEMCACHE_BIT(MEMCACHE_THUMB);
+                if(job->image != NULL && (jpeg->queued & THUMB_UPSCALED)) { // replaces a blurry one
+                    memcache_remove(memCache, jpeg, MEMCACHE_THUMB);
+                    jpeg->queued &= ~THUMB_UPSCALED;
+                    if(gridTop >= 0 && job->index >= gridTop && job->index < gridTop + gridCells)
+                        gridShown[job->index - gridTop] = CELL_UNKNOWN; // same state, still redraw
+                }
+                if(job->image == NULL)
+                    jpeg->failed |= MEMCACHE_BIT(MEMCACHE_THUMB);
+                else if((item = memcache_put_image(memCache, jpeg, MEMCACHE_THUMB, job->image)) != NULL) {
+                    job->image = NULL;
+                    memcache_release(memCache, item);
+                }
+                if(mode == MODE_THUMBS && job->index >= currentImage && job->index < currentImage + tx*ty)
                     redraw = 1; // load affected current view
-                break;
             }
+            destroy_jobs(job);
         }
 
+        if(showHud && hud_update(hud, pool, memCache, prefetch, thumbsLeft)) {
+            if(mode == MODE_FULLSIZE)
+                redraw = 1; // rendered from textures anyway
+            else
+                present = 1; // screen texture is still good
+        }
+
+        frameStart = SDL_GetPerformanceCounter();
+        framed = redraw || present;
+
         if(redraw) {
+            if(mode == MODE_THUMBS) // drawThumbs() tags each cell
+                trace_entry(NULL, 0, 0);
+            else
+                trace_entry(catalog_entry(catalog, currentImage), screen->w, screen->h);
             switch(mode) {
                 case MODE_THUMBS:
-                    drawThumbs(screen, font24, tx, ty, currentImage);
+                    drawThumbs(screen, font24, tx, ty, currentImage, &dirty);
                     break;
                 case MODE_FULLSCREEN:
-                    if(fullscreen != NULL)
+                    if(loadedFullscreen != currentImage && previewIndex == currentImage && preview != NULL) {
+                        if((fit = scale(preview, screen->w, screen->h)) != NULL) {
+                            drawImage(screen, fit, 0, 0);
+                            destroy_image(fit);
+                        }
+                    } else if(fullscreen != NULL)
                         drawImage(screen, fullscreen, 0, 0);
                     break;
-                case MODE_FULLSIZE:
-                    if(fullsize != NULL) drawImage(screen, fullsize,
-                        (fullsize->w <= screen->w) ? 0 : (fullsize->w - screen->w) * mousex / screen->w,
-                        (fullsize->h <= screen->h) ? 0 : (fullsize->h - screen->h) * mousey / screen->h);
+                case MODE_FULLSIZE: // straight from textures, screen is not used
+                    gridTop = -1; // thumbs are redrawn fully when back
+                    SDL_RenderClear(renderer);
+                    if(tiled != NULL && loadedFullsize == currentImage) {
+                        vw = MIN(screen->w, tiled->w[0]);
+                        vh = MIN(screen->h, tiled->h[0]);
+                        xoff = (tiled->w[0] - vw) * mousex / screen->w;
+                        yoff = (tiled->h[0] - vh) * mousey / screen->h;
+                        tiled_request(tiled, xoff, yoff, vw, vh);
+                        tiled_render(tiled, renderer, xoff, yoff, screen->w, screen->h);
+                    } else if(loadedFullsize != currentImage && previewIndex == currentImage && preview != NULL) {
+                        if((previewView = viewFor(previewView, renderer, catalog_entry(catalog, previewIndex),
+                                        preview->w, preview->h, 3)) != NULL) // preview is 1/8 scale
+                            renderView(previewView, preview, previewW, previewH,
+                                    screen->w, screen->h, mousex, mousey);
+                    } else if(fullsize != NULL && loadedFullsize >= 0) {
+                        if((fullView = viewFor(fullView, renderer, catalog_entry(catalog, loadedFullsize),
+                                        fullsize->w, fullsize->h, 0)) != NULL)
+                            renderView(fullView, fullsize, fullsize->w, fullsize->h,
+                                    screen->w, screen->h, mousex, mousey);
+                    }
+                    if(showHud)
+                        hud_render(hud);
+                    span = trace_start();
+                    SDL_RenderPresent(renderer);
+                    trace_end("present", span);
                     break;
             }
-            SDL_UpdateTexture(texture, NULL, screen->data, screen->w * sizeof (Uint32));
+            if(mode == MODE_FULLSCREEN) { // draws the whole screen
+                gridTop = -1;
+                dirty_all(&dirty, screen);
+            }
+            if(mode != MODE_FULLSIZE) { // only what changed
+                span = trace_start();
+                if(dirty_upload(&dirty, texture, screen))
+                    present = 1;
+                trace_end("upload", span);
+            }
+            trace_entry(NULL, 0, 0);
+            redraw = 0;
+        }
+
+        if(present && mode != MODE_FULLSIZE) {
             SDL_RenderCopy(renderer, texture, NULL, NULL);
+            if(showHud)
+                hud_render(hud);
+            span = trace_start();
             SDL_RenderPresent(renderer);
-            redraw = 0;
+            trace_end("present", span);
         }
+        present = 0;
+
+        if(framed && hud != NULL)
+            hud_frame(hud, SDL_GetPerformanceCounter() - frameStart);
 
         while(SDL_PollEvent(&event)) {
             switch(event.type) {
@@ -532,6 +800,16 @@ int main(int argc, char *argv[]) {
                             if(mode == MODE_THUMBS) // trigger on mouseup so it won't go to O/S after exit
                                 done = 1; // will transition to done = 2 on mouseup
                             else if(mode == MODE_FULLSIZE) {
+                                cancelFullsize(pool);
+                                if(tiled != NULL) { // tiles are only kept while looking at them
+                                    destroy_tiled(tiled);
+                                    tiled = NULL;
+                                    loadedFullsize = -1;
+                                }
+                                if(fullView != NULL) { // same for textures
+                                    destroy_texview(fullView);
+                                    fullView = NULL;
+                                }
                                 mode = MODE_FULLSCREEN;
                             } else if(mode == MODE_FULLSCREEN) { // Back to thumbnails
                                 if(earlierImage <= currentImage && currentImage < earlierImage + tx*ty)
@@ -542,6 +820,13 @@ int main(int argc, char *argv[]) {
                                 if(currentImage < 0)
                                     currentImage = 0;
                                 mode = MODE_THUMBS;
+                                thumbsLeft = 1; // some may have been evicted meanwhile
+
+                                prefetch_stop(prefetch);
+                                memcache_release(memCache, fullscreenItem);
+                                fullscreenItem = NULL;
+                                fullscreen = NULL;
+                                loadedFullscreen = -1;
                             }
                             SDL_ShowCursor(mode == MODE_THUMBS ? 1 : 0);
                             redraw = 1;
@@ -570,6 +855,7 @@ int main(int argc, char *argv[]) {
                             currentImage -= tx;
                             if(currentImage < 0)
                                 currentImage = 0;
+                            thumbsLeft = 1;
                         } else {
                             if(currentImage)
                                 currentImage--;
@@ -581,6 +867,7 @@ int main(int argc, char *argv[]) {
                             if(currentImage + tx * ty >= jpeg_count)
                                 break;
                             currentImage += tx;
+                            thumbsLeft = 1;
                         } else {
                             if(++currentImage >= jpeg_count)
                                 currentImage = jpeg_count - 1;
@@ -608,25 +895,29 @@ int main(int argc, char *argv[]) {
                                 SDL_TEXTUREACCESS_STREAMING,
                                 screen->w, screen->h);
                         if (!texture) { writeMessage(SDL_MESSAGEBOX_ERROR, "Error message", "Couldn't create texture for new size!"); quit(1); }
+                        gridTop = -1; // new texture is blank
+                        dirty_clear(&dirty);
                         
                         // Recalculate thumbnail grid, ensuring tx and ty are at least 1
                         tx = (screen->w / THUMB_W > 0) ? screen->w / THUMB_W : 1;
                         ty = (screen->h / THUMB_H > 0) ? screen->h / THUMB_H : 1;
+                        slab_set_size(screen->w / tx, screen->h / ty); // old slabs go with old thumbs
                         
-                        // Invalidate all existing thumbnails to force reload with new dimensions
-                        for(i = 0; i < jpeg_count; i++) {
-                            if(jpegs[i].thumbnail != NULL) {
-                                destroy_image(jpegs[i].thumbnail);
-                                jpegs[i].thumbnail = NULL;
-                            }
-                            jpegs[i].loaded = 0;
-                        }
-                        thumbsLeft = jpeg_count;
+                        // Cached thumbnails are rescaled by drawThumbs() as they come
+                        // into view, only ones not loaded yet need decoding
+                        destroy_jobs(pool_cancel(pool, MEMCACHE_THUMB));
+                        thumbGeneration++; // in-flight loads will be discarded
+                        for(i = 0; i < jpeg_count; i++)
+                            catalog_entry(catalog, i)->queued &= ~MEMCACHE_BIT(MEMCACHE_THUMB);
+                        thumbsLeft = 1;
                         
-                        // Reload fullscreen image if needed
-                        if(mode == MODE_FULLSCREEN) {
-                            loadedFullscreen = -1; // Force reload at correct size
-                        }
+                        // Fullscreen images are for old size, reload if needed
+                        prefetch_stop(prefetch);
+                        memcache_release(memCache, fullscreenItem);
+                        memcache_remove_kind(memCache, MEMCACHE_FULLSCREEN);
+                        fullscreenItem = NULL;
+                        fullscreen = NULL;
+                        loadedFullscreen = -1;
                         // If in fullsize mode, the image itself is original size, but view might need update
                         if(mode == MODE_FULLSIZE) {
                             loadedFullsize = -1; // Force reload if necessary, or at least re-evaluate view
@@ -642,6 +933,12 @@ int main(int argc, char *argv[]) {
                         case SDLK_q: case SDLK_x:
                             done = 2;
                             break;
+                        case SDLK_h: // Toggle performance HUD
+                            if(hud == NULL)
+                                hud = create_hud(renderer, font24);
+                            showHud = !showHud && hud != NULL;
+                            redraw = present = 1;
+                            break;
                         case SDLK_f: // Toggle fullscreen
                             if(windowed) { // Currently windowed, switch to fullscreen
                                 SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
@@ -671,17 +968,46 @@ int main(int argc, char *argv[]) {
                     break;
             } // end switch(event.type)
         } // end while(SDL_PollEvent(&event))
+
+        if(!redraw) { // don't spin while workers are busy
+            slab_release_scratch(); // loadCached() decodes seldom, don't hold memory for it
+            pool_wait(pool, 5);
+        }
     } // end while(!done)
 
+    if(tiled != NULL)
+        destroy_tiled(tiled);
+    destroy_prefetch(prefetch); // before pool, these cancel jobs there
+    destroy_pool(pool);
+
+    if(cacheStats)
+        memcache_report(memCache, stdout);
+    memcache_release(memCache, fullscreenItem);
+    memcache_release(memCache, fullsizeItem);
+    destroy_memcache(memCache);
+    if(preview != NULL)
+        destroy_image(preview);
+    if(fullView != NULL)
+        destroy_texview(fullView);
+    if(previewView != NULL)
+        destroy_texview(previewView);
+
+    if(hud != NULL)
+        destroy_hud(hud);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     destroy_image(screen);
+    free(gridShown);
 
     destroy_font(font24);
 
-    zip->close(zip);
+    quit_trace(catalog); // names come from the catalogue
+    destroy_catalog(catalog); // after pool, workers use its handles
+    free(paths);
+    quit_loader();
+    quit_slabs();
 #ifdef LOGFILE
     fclose(logfile);
 #endif
@@ -0,0 +1,381 @@
+/**
+ * Memory mapped and positional read JZFile implementations.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#if defined _WIN32 || defined _WIN64
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapfile.h"
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+typedef struct {
+    JZFile handle;
+    const unsigned char *base;
+    size_t size, pos;
+} MappedJZFile;
+
+typedef struct {
+    JZFile handle;
+#if defined _WIN32 || defined _WIN64
+    HANDLE file;
+#else
+    int fd;
+#endif
+    Uint64 size, pos;
+} PreadJZFile;
+
+static size_t mapped_read(JZFile *file, void *buf, size_t size) {
+    MappedJZFile *handle = (MappedJZFile *)file;
+
+    if(handle->pos >= handle->size)
+        return 0;
+
+    if(size > handle->size - handle->pos)
+        size = handle->size - handle->pos;
+
+    memcpy(buf, handle->base + handle->pos, size);
+    handle->pos += size;
+
+    return size;
+}
+
+static size_t mapped_tell(JZFile *file) {
+    return ((MappedJZFile *)file)->pos;
+}
+
+static int mapped_seek(JZFile *file, size_t offset, int whence) {
+    MappedJZFile *handle = (MappedJZFile *)file;
+    size_t pos;
+
+    switch(whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = handle->pos + offset; break;
+        case SEEK_END: pos = handle->size + offset; break;
+        default: return -1;
+    }
+
+    if(pos > handle->size)
+        return -1;
+
+    handle->pos = pos;
+    return 0;
+}
+
+static int mapped_error(JZFile *file) {
+    (void)file;
+    return 0;
+}
+
+static void mapped_close(JZFile *file) {
+    MappedJZFile *handle = (MappedJZFile *)file;
+
+#if defined _WIN32 || defined _WIN64
+    UnmapViewOfFile(handle->base);
+#else
+    munmap((void *)handle->base, handle->size);
+#endif
+    free(handle);
+}
+
+JZFile *jzfile_from_mapped_file(const char *filename) {
+    MappedJZFile *handle;
+    const unsigned char *base = NULL;
+    size_t size;
+#if defined _WIN32 || defined _WIN64
+    HANDLE file, mapping;
+    LARGE_INTEGER fileSize;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if(!GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart ||
+            (unsigned long long)fileSize.QuadPart > (size_t)-1) { // too big for 32-bit address space
+        CloseHandle(file);
+        return NULL;
+    }
+    size = (size_t)fileSize.QuadPart;
+
+    if((mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL) {
+        base = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping); // view keeps mapping alive
+    }
+    CloseHandle(file);
+
+    if(base == NULL)
+        return NULL;
+#else
+    struct stat st;
+    void *map;
+    int fd;
+
+    if((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
+
+    if(fstat(fd, &st) || st.st_size <= 0 || (unsigned long long)st.st_size > (size_t)-1) {
+        close(fd);
+        return NULL;
+    }
+    size = (size_t)st.st_size;
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // mapping stays valid
+
+    if(map == MAP_FAILED)
+        return NULL;
+
+    base = (const unsigned char *)map;
+#endif
+
+    if((handle = (MappedJZFile *)malloc(sizeof(MappedJZFile))) == NULL) {
+#if defined _WIN32 || defined _WIN64
+        UnmapViewOfFile(base);
+#else
+        munmap(map, size);
+#endif
+        return NULL;
+    }
+
+    handle->handle.read = mapped_read;
+    handle->handle.tell = mapped_tell;
+    handle->handle.seek = mapped_seek;
+    handle->handle.error = mapped_error;
+    handle->handle.close = mapped_close;
+    handle->base = base;
+    handle->size = size;
+    handle->pos = 0;
+
+    return &(handle->handle);
+}
+
+const unsigned char *jzfile_mapping(JZFile *zip, size_t *size) {
+    MappedJZFile *handle = (MappedJZFile *)zip;
+
+    if(zip->read != mapped_read)
+        return NULL;
+
+    *size = handle->size;
+    return handle->base;
+}
+
+void jzfile_advise(JZFile *zip, size_t offset, size_t size) {
+    MappedJZFile *handle = (MappedJZFile *)zip;
+#if !defined _WIN32 && !defined _WIN64
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+
+    if(zip->read != mapped_read || offset >= handle->size)
+        return;
+
+    if(size > handle->size - offset)
+        size = handle->size - offset;
+
+#if defined _WIN32 || defined _WIN64
+    (void)size; // PrefetchVirtualMemory() needs Windows 8, faults do the job
+#else
+    size += offset % page; // must start at page boundary
+    posix_madvise((void *)(handle->base + offset - offset % page), size, POSIX_MADV_WILLNEED);
+#endif
+}
+
+static size_t preadAt(PreadJZFile *handle, Uint64 offset, void *buf, size_t size) {
+    size_t done = 0;
+#if defined _WIN32 || defined _WIN64
+    OVERLAPPED overlapped;
+    DWORD got;
+
+    while(done < size) {
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)(offset + done);
+        overlapped.OffsetHigh = (DWORD)((offset + done) >> 32);
+        if(!ReadFile(handle->file, (char *)buf + done, (DWORD)MIN(size - done, 1 << 30),
+                    &got, &overlapped) || !got)
+            break;
+        done += got;
+    }
+#else
+    ssize_t got;
+
+    while(done < size && (got = pread(handle->fd, (char *)buf + done, size - done,
+                    (off_t)(offset + done))) > 0)
+        done += got;
+#endif
+
+    return done;
+}
+
+static size_t pread_read(JZFile *file, void *buf, size_t size) {
+    PreadJZFile *handle = (PreadJZFile *)file;
+
+    size = preadAt(handle, handle->pos, buf, size);
+    handle->pos += size;
+
+    return size;
+}
+
+static size_t pread_tell(JZFile *file) {
+    return (size_t)((PreadJZFile *)file)->pos;
+}
+
+static int pread_seek(JZFile *file, size_t offset, int whence) {
+    PreadJZFile *handle = (PreadJZFile *)file;
+    Uint64 pos;
+
+    switch(whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = handle->pos + offset; break;
+        case SEEK_END: pos = handle->size + offset; break;
+        default: return -1;
+    }
+
+    if(pos > handle->size)
+        return -1;
+
+    handle->pos = pos;
+    return 0;
+}
+
+static int pread_error(JZFile *file) {
+    (void)file;
+    return 0;
+}
+
+static void pread_close(JZFile *file) {
+    PreadJZFile *handle = (PreadJZFile *)file;
+
+#if defined _WIN32 || defined _WIN64
+    CloseHandle(handle->file);
+#else
+    close(handle->fd);
+#endif
+    free(handle);
+}
+
+JZFile *jzfile_from_pread_file(const char *filename) {
+    PreadJZFile *handle;
+#if defined _WIN32 || defined _WIN64
+    LARGE_INTEGER fileSize;
+#else
+    struct stat st;
+#endif
+
+    if((handle = (PreadJZFile *)calloc(1, sizeof(PreadJZFile))) == NULL)
+        return NULL;
+
+#if defined _WIN32 || defined _WIN64
+    handle->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle->file == INVALID_HANDLE_VALUE) {
+        free(handle);
+        return NULL;
+    }
+
+    if(!GetFileSizeEx(handle->file, &fileSize)) {
+        CloseHandle(handle->file);
+        free(handle);
+        return NULL;
+    }
+    handle->size = (Uint64)fileSize.QuadPart;
+#else
+    if((handle->fd = open(filename, O_RDONLY)) < 0) {
+        free(handle);
+        return NULL;
+    }
+
+    if(fstat(handle->fd, &st)) {
+        close(handle->fd);
+        free(handle);
+        return NULL;
+    }
+    handle->size = (Uint64)st.st_size;
+#endif
+
+    handle->handle.read = pread_read;
+    handle->handle.tell = pread_tell;
+    handle->handle.seek = pread_seek;
+    handle->handle.error = pread_error;
+    handle->handle.close = pread_close;
+
+    return &(handle->handle);
+}
+
+size_t jzfile_read_at(JZFile *zip, Uint64 offset, void *buf, size_t size) {
+    MappedJZFile *mapped = (MappedJZFile *)zip;
+
+    if(zip->read == pread_read)
+        return preadAt((PreadJZFile *)zip, offset, buf, size);
+
+    if(zip->read == mapped_read) {
+        if(offset >= mapped->size)
+            return 0;
+        size = MIN(size, mapped->size - (size_t)offset);
+        memcpy(buf, mapped->base + offset, size);
+        return size;
+    }
+
+    if(offset > (size_t)-1 || zip->seek(zip, (size_t)offset, SEEK_SET))
+        return 0;
+
+    return zip->read(zip, buf, size);
+}
+
+int jzfile_positional(JZFile *zip) {
+    return zip->read == pread_read || zip->read == mapped_read;
+}
+
+Uint64 jzfile_size(JZFile *zip) {
+    size_t pos;
+    Uint64 size;
+
+    if(zip->read == pread_read)
+        return ((PreadJZFile *)zip)->size;
+
+    if(zip->read == mapped_read)
+        return ((MappedJZFile *)zip)->size;
+
+    pos = zip->tell(zip);
+    size = zip->seek(zip, 0, SEEK_END) ? 0 : zip->tell(zip);
+    zip->seek(zip, pos, SEEK_SET);
+
+    return size;
+}
+
+JZFile *jzfile_open(const char *filename) {
+    JZFile *zip;
+
+    if((zip = jzfile_from_mapped_file(filename)) == NULL)
+        zip = jzfile_from_pread_file(filename);
+
+    return zip;
+}
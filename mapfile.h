@@ -0,0 +1,68 @@
+/**
+ * Memory mapped and positional read JZFile implementations.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __MAPFILE_H
+#define __MAPFILE_H
+
+#include <stdio.h>
+
+#include "SDL2/SDL.h"
+
+#include "junzip.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// Map whole file read-only, returns NULL if it can't be mapped
+JZFile *jzfile_from_mapped_file(const char *filename);
+
+// For files that can't be mapped, e.g. huge ones on 32-bit systems. Reads
+// go through pread() (ReadFile() with an offset on Windows), so 64-bit
+// offsets work and jzfile_read_at() needs no locking.
+JZFile *jzfile_from_pread_file(const char *filename);
+
+// Mapped if possible, pread otherwise (e.g. huge files on 32-bit systems).
+// Returns NULL if the file can't be opened.
+JZFile *jzfile_open(const char *filename);
+
+// Read at a 64-bit offset without using the file position. Other JZFiles
+// go through seek and read, so callers must serialize those and offset must
+// fit in size_t. Returns bytes read.
+size_t jzfile_read_at(JZFile *zip, Uint64 offset, void *buf, size_t size);
+
+// Nonzero if jzfile_read_at() is thread safe for zip
+int jzfile_positional(JZFile *zip);
+
+Uint64 jzfile_size(JZFile *zip);
+
+// Mapped file contents, or NULL if zip is not from jzfile_from_mapped_file
+const unsigned char *jzfile_mapping(JZFile *zip, size_t *size);
+
+// Hint that size bytes at offset of a mapped file are needed soon, so the
+// kernel reads them in one go instead of page by page
+void jzfile_advise(JZFile *zip, size_t offset, size_t size);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * Byte-budgeted in-memory LRU cache for entry data and decoded images.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memcache.h"
+
+#define INITIAL_BUCKETS 1024
+
+static const char *kindNames[MEMCACHE_KINDS] = {
+    "data", "thumb", "fullscreen", "fullsize", "tile"
+};
+
+static unsigned int hashKey(const void *key, int kind, int bucketCount) {
+    size_t h = (size_t)key;
+
+    h ^= h >> 7; // records are spaced by struct size, mix low bits in
+    h = h * 31 + kind;
+    return (unsigned int)(h ^ (h >> 16)) & (bucketCount - 1);
+}
+
+static void freeObject(JMemCacheItem *item) {
+    if(item->kind == MEMCACHE_DATA)
+        free(item->object);
+    else
+        destroy_image((JImage *)item->object);
+    free(item);
+}
+
+static JMemCacheItem **findSlot(JMemCache *cache, const void *key, int kind) {
+    JMemCacheItem **slot = &cache->buckets[hashKey(key, kind, cache->bucketCount)];
+
+    while(*slot != NULL && ((*slot)->key != key || (*slot)->kind != kind))
+        slot = &(*slot)->hashNext;
+
+    return slot;
+}
+
+static void unlinkLRU(JMemCache *cache, JMemCacheItem *item) {
+    if(item->newer) item->newer->older = item->older;
+    else cache->newest = item->older;
+
+    if(item->older) item->older->newer = item->newer;
+    else cache->oldest = item->newer;
+
+    item->newer = item->older = NULL;
+}
+
+static void linkNewest(JMemCache *cache, JMemCacheItem *item) {
+    item->older = cache->newest;
+    item->newer = NULL;
+
+    if(cache->newest) cache->newest->newer = item;
+    else cache->oldest = item;
+
+    cache->newest = item;
+}
+
+// Take item out of hash and LRU, freeing it unless someone has it pinned
+static void removeItem(JMemCache *cache, JMemCacheItem *item) {
+    JMemCacheItem **slot = findSlot(cache, item->key, item->kind);
+
+    *slot = item->hashNext;
+    unlinkLRU(cache, item);
+    cache->count--;
+    cache->bytes -= item->bytes;
+    cache->kindBytes[item->kind] -= item->bytes;
+
+    if(item->refs)
+        item->dead = 1;
+    else
+        freeObject(item);
+}
+
+static void grow(JMemCache *cache) {
+    JMemCacheItem **buckets, *item, *next;
+    int i, count = cache->bucketCount * 2;
+    unsigned int h;
+
+    if((buckets = (JMemCacheItem **)calloc(count, sizeof(JMemCacheItem *))) == NULL)
+        return; // chains just get longer
+
+    for(i = 0; i < cache->bucketCount; i++) {
+        for(item = cache->buckets[i]; item != NULL; item = next) {
+            next = item->hashNext;
+            h = hashKey(item->key, item->kind, count);
+            item->hashNext = buckets[h];
+            buckets[h] = item;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucketCount = count;
+}
+
+static void evict(JMemCache *cache) {
+    JMemCacheItem *item = cache->oldest, *newer;
+
+    for(; item != NULL && cache->bytes > cache->limit; item = newer) {
+        newer = item->newer;
+        if(item->refs)
+            continue; // in use, try the next one
+        cache->evictions[item->kind]++;
+        removeItem(cache, item);
+    }
+}
+
+JMemCache *create_memcache(long long limit) {
+    JMemCache *cache = (JMemCache *)calloc(1, sizeof(JMemCache));
+
+    if(cache == NULL)
+        return NULL;
+
+    cache->limit = limit;
+    cache->bucketCount = INITIAL_BUCKETS;
+    cache->buckets = (JMemCacheItem **)calloc(cache->bucketCount, sizeof(JMemCacheItem *));
+    cache->lock = SDL_CreateMutex();
+
+    if(cache->buckets == NULL || cache->lock == NULL) {
+        destroy_memcache(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void destroy_memcache(JMemCache *cache) {
+    JMemCacheItem *item, *older;
+
+    for(item = cache->newest; item != NULL; item = older) {
+        older = item->older;
+        freeObject(item);
+    }
+
+    if(cache->lock != NULL)
+        SDL_DestroyMutex(cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+JMemCacheItem *memcache_get(JMemCache *cache, const void *key, int kind) {
+    JMemCacheItem *item;
+
+    SDL_LockMutex(cache->lock);
+
+    if((item = *findSlot(cache, key, kind)) != NULL) {
+        item->refs++;
+        unlinkLRU(cache, item);
+        linkNewest(cache, item);
+        cache->hits[kind]++;
+    } else
+        cache->misses[kind]++;
+
+    SDL_UnlockMutex(cache->lock);
+
+    return item;
+}
+
+int memcache_contains(JMemCache *cache, const void *key, int kind) {
+    int found;
+
+    SDL_LockMutex(cache->lock);
+    found = *findSlot(cache, key, kind) != NULL;
+    SDL_UnlockMutex(cache->lock);
+
+    return found;
+}
+
+JMemCacheItem *memcache_put(JMemCache *cache, const void *key, int kind,
+        void *object, size_t bytes) {
+    JMemCacheItem **slot, *item;
+
+    SDL_LockMutex(cache->lock);
+
+    if((item = *(slot = findSlot(cache, key, kind))) != NULL) { // someone was faster
+        item->refs++;
+        SDL_UnlockMutex(cache->lock);
+        if(kind == MEMCACHE_DATA)
+            free(object);
+        else
+            destroy_image((JImage *)object);
+        return item;
+    }
+
+    if((item = (JMemCacheItem *)calloc(1, sizeof(JMemCacheItem))) == NULL) {
+        SDL_UnlockMutex(cache->lock);
+        return NULL;
+    }
+
+    item->key = key;
+    item->kind = kind;
+    item->object = object;
+    item->bytes = bytes + sizeof(JMemCacheItem);
+    item->refs = 1;
+    *slot = item;
+    linkNewest(cache, item);
+
+    cache->count++;
+    cache->bytes += item->bytes;
+    cache->kindBytes[kind] += item->bytes;
+
+    if(cache->count > cache->bucketCount)
+        grow(cache);
+
+    evict(cache);
+
+    SDL_UnlockMutex(cache->lock);
+
+    return item;
+}
+
+JMemCacheItem *memcache_put_image(JMemCache *cache, const void *key, int kind, JImage *image) {
+    return memcache_put(cache, key, kind, image,
+            sizeof(JImage) + (size_t)image->w * image->h * sizeof(Uint32));
+}
+
+void memcache_release(JMemCache *cache, JMemCacheItem *item) {
+    if(item == NULL)
+        return;
+
+    SDL_LockMutex(cache->lock);
+
+    if(--item->refs == 0) {
+        if(item->dead)
+            freeObject(item);
+        else
+            evict(cache); // may have been kept over the limit
+    }
+
+    SDL_UnlockMutex(cache->lock);
+}
+
+void memcache_remove(JMemCache *cache, const void *key, int kind) {
+    JMemCacheItem *item;
+
+    SDL_LockMutex(cache->lock);
+
+    if((item = *findSlot(cache, key, kind)) != NULL)
+        removeItem(cache, item);
+
+    SDL_UnlockMutex(cache->lock);
+}
+
+void memcache_remove_kind(JMemCache *cache, int kind) {
+    JMemCacheItem *item, *older;
+
+    SDL_LockMutex(cache->lock);
+
+    for(item = cache->newest; item != NULL; item = older) {
+        older = item->older;
+        if(item->kind == kind)
+            removeItem(cache, item);
+    }
+
+    SDL_UnlockMutex(cache->lock);
+}
+
+void memcache_counts(JMemCache *cache, int *hits, int *misses, long long *kindBytes) {
+    int i;
+
+    *hits = *misses = 0;
+
+    SDL_LockMutex(cache->lock);
+    for(i = 0; i < MEMCACHE_KINDS; i++) {
+        *hits += cache->hits[i];
+        *misses += cache->misses[i];
+        kindBytes[i] = cache->kindBytes[i];
+    }
+    SDL_UnlockMutex(cache->lock);
+}
+
+void memcache_report(JMemCache *cache, FILE *fp) {
+    int i;
+
+    SDL_LockMutex(cache->lock);
+
+    fprintf(fp, "Memory cache: %.1f / %.1f MB in %d items\n",
+            cache->bytes / 1048576.0, cache->limit / 1048576.0, cache->count);
+    for(i = 0; i < MEMCACHE_KINDS; i++)
+        fprintf(fp, "  %-10s %8.1f MB  hits %7d  misses %7d  evictions %7d\n",
+                kindNames[i], cache->kindBytes[i] / 1048576.0,
+                cache->hits[i], cache->misses[i], cache->evictions[i]);
+
+    SDL_UnlockMutex(cache->lock);
+}
@@ -0,0 +1,115 @@
+/**
+ * Byte-budgeted in-memory LRU cache for entry data and decoded images.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __MEMCACHE_H
+#define __MEMCACHE_H
+
+#include <stdio.h>
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Items are keyed by owner pointer (usually a JPEGRecord) and kind. Every
+ * get or put pins the item, and pinned items are never freed, so other
+ * threads can't pull data from under a decode or a blit. When the total
+ * goes over the limit, least recently used unpinned items are evicted.
+ */
+
+typedef enum {
+    MEMCACHE_DATA, // uncompressed entry data, malloc'd
+    MEMCACHE_THUMB, // the rest are JImages
+    MEMCACHE_FULLSCREEN,
+    MEMCACHE_FULLSIZE,
+    MEMCACHE_TILE, // part of a huge image, see tiles.h
+    MEMCACHE_KINDS
+} JMemCacheKind;
+
+#define MEMCACHE_BIT(kind) (1 << (kind))
+
+typedef struct JMemCacheItem {
+    const void *key;
+    int kind;
+    void *object;
+    size_t bytes;
+    int refs; // pinned while nonzero
+    int dead; // already removed, freed on last release
+    struct JMemCacheItem *hashNext;
+    struct JMemCacheItem *newer, *older; // LRU list
+} JMemCacheItem;
+
+typedef struct {
+    long long limit, bytes;
+    JMemCacheItem **buckets;
+    int bucketCount, count;
+    JMemCacheItem *newest, *oldest;
+    SDL_mutex *lock;
+
+    // Statistics, read without locking if you don't mind slight staleness
+    long long kindBytes[MEMCACHE_KINDS];
+    int hits[MEMCACHE_KINDS], misses[MEMCACHE_KINDS], evictions[MEMCACHE_KINDS];
+} JMemCache;
+
+JMemCache *create_memcache(long long limit);
+
+// Frees everything, no items may be in use anymore
+void destroy_memcache(JMemCache *cache);
+
+// Thread safe, returns pinned item or NULL on miss
+JMemCacheItem *memcache_get(JMemCache *cache, const void *key, int kind);
+
+// Like memcache_get but without pinning or touching LRU order or statistics
+int memcache_contains(JMemCache *cache, const void *key, int kind);
+
+// Thread safe, cache takes ownership of object and returns it pinned. If
+// key was already there, object is freed and the existing item returned.
+// Returns NULL on allocation failure, caller still owns object then.
+JMemCacheItem *memcache_put(JMemCache *cache, const void *key, int kind,
+        void *object, size_t bytes);
+
+// Same as above, calculating bytes from image size
+JMemCacheItem *memcache_put_image(JMemCache *cache, const void *key, int kind, JImage *image);
+
+// Unpin item, NULL is fine
+void memcache_release(JMemCache *cache, JMemCacheItem *item);
+
+// Drop one item if it's there, e.g. when its key is about to be freed
+void memcache_remove(JMemCache *cache, const void *key, int kind);
+
+// Drop all items of given kind, e.g. after they are stale due to a resize
+void memcache_remove_kind(JMemCache *cache, int kind);
+
+// Hits and misses summed over kinds, and bytes held of each kind
+void memcache_counts(JMemCache *cache, int *hits, int *misses, long long *kindBytes);
+
+// Print hit/miss/eviction counts per kind
+void memcache_report(JMemCache *cache, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
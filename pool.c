@@ -0,0 +1,489 @@
+/**
+ * Thumbnail worker pool.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "mapfile.h"
+#include "slab.h"
+#include "trace.h"
+
+#define READ_BATCH 64 // most jobs sorted at once
+#define READ_GAP (256 * 1024) // read over holes smaller than this
+#define READ_MAX (16 * 1024 * 1024) // largest single read
+#define READ_BUFFERED (64 * 1024 * 1024) // wait for decoders above this
+#define LOCAL_EXTRA 1024 // local header extra field we expect at most
+
+struct JReadBlock {
+    JPool *pool;
+    int refs; // jobs using this, under pool lock
+    long size;
+    unsigned char data[1];
+};
+
+// Call with pool lock held
+static void releaseBlock(JPool *pool, JLoadJob *job) {
+    struct JReadBlock *block = job->block;
+
+    if(block == NULL)
+        return;
+
+    job->block = NULL;
+    job->raw = NULL;
+
+    if(--block->refs == 0) {
+        pool->buffered -= block->size;
+        free(block);
+        SDL_CondSignal(pool->readWake);
+    }
+}
+
+// Thumbnails are workers' to add to and reader's to remove from, the rest
+// can go anywhere. Call with pool lock held.
+static void queueJob(JPool *pool, JLoadJob *job) {
+    JLoadJob **prev;
+
+    job->next = NULL;
+
+    if(job->kind == MEMCACHE_THUMB) {
+        if(pool->queueTail)
+            pool->queueTail->next = job;
+        else
+            pool->queue = job;
+        pool->queueTail = job;
+    } else { // after other urgent ones, queue is short so just walk it
+        for(prev = &pool->queue; *prev != NULL && (*prev)->kind != MEMCACHE_THUMB; prev = &(*prev)->next)
+            ;
+        if((job->next = *prev) == NULL)
+            pool->queueTail = job;
+        *prev = job;
+    }
+
+    SDL_CondSignal(pool->wake);
+}
+
+// End of entry in archive, local header extra field is estimated
+static Sint64 entryEnd(JPEGRecord *jpeg) {
+    return jpeg->offset + 30 + jpeg->nameLength + LOCAL_EXTRA + jpeg->compressedSize;
+}
+
+static const char *jobNames[MEMCACHE_KINDS] = {
+    "data job", "thumb job", "fullscreen job", "fullsize job", "tile job"
+};
+
+// Returns 0 if thumbnail needs reading first
+static int loadJob(JPool *pool, JLoadJob *job) {
+    JThumbCache *cache = NULL;
+    JZFile *zip = NULL;
+
+    if(job->kind == MEMCACHE_THUMB) {
+        cache = catalog_thumbs(pool->catalog, job->jpeg);
+        if(!job->scheduled && cache != NULL &&
+                (job->image = thumbcache_get(cache, job->jpeg, job->w, job->h)) != NULL)
+            return 1; // archive isn't even opened
+        // Even EXIF is read in offset order, but huge entries are streamed
+        // instead of buffered whole
+        if(!job->scheduled && entryEnd(job->jpeg) - job->jpeg->offset <= READ_MAX)
+            return 0;
+    }
+
+    // EXIF thumbnail is much cheaper when there's one
+    if(job->raw != NULL) {
+        if(job->kind == MEMCACHE_THUMB)
+            job->image = loadExifThumbFromRaw(job->jpeg, job->raw, job->w, job->h);
+        if(job->image == NULL)
+            job->image = loadImageFromRaw(job->jpeg, job->raw, job->w, job->h, &job->times);
+    } else if((zip = catalog_open(pool->catalog, job->jpeg)) == NULL)
+        job->image = NULL; // archive has gone away
+    else if(job->kind == MEMCACHE_TILE)
+        job->image = loadRegionFromZip(zip, job->jpeg, job->level, job->x, job->y, job->w, job->h);
+    else { // mapped, too big to buffer or local header was bigger than expected
+        if(job->kind == MEMCACHE_THUMB)
+            job->image = loadExifThumbFromZip(zip, job->jpeg, job->w, job->h);
+        if(job->image == NULL)
+            job->image = loadImageTimed(zip, job->jpeg, job->w, job->h, &job->times);
+    }
+
+    if(zip != NULL)
+        catalog_release(pool->catalog, job->jpeg);
+
+    if(cache != NULL && job->image != NULL)
+        thumbcache_put(cache, job->jpeg, job->w, job->h, job->image);
+
+    return 1;
+}
+
+static int runJob(JPool *pool, JLoadJob *job) {
+    Uint64 span;
+    int finished;
+
+    trace_entry(job->jpeg, job->w, job->h);
+    span = trace_start();
+    finished = loadJob(pool, job);
+    trace_end(jobNames[job->kind], span);
+    trace_entry(NULL, 0, 0);
+
+    return finished;
+}
+
+static int worker(void *data) {
+    JPool *pool = (JPool *)data;
+    JLoadJob *job;
+    int finished;
+
+    trace_thread("loader");
+
+    SDL_LockMutex(pool->lock);
+
+    while(!pool->quit) {
+        if((job = pool->queue) == NULL) {
+            if(!pool->pending) // whole pool is idle, give decode memory back
+                slab_release_scratch();
+            SDL_CondWait(pool->wake, pool->lock);
+            continue;
+        }
+
+        if((pool->queue = job->next) == NULL) {
+            pool->queueTail = NULL;
+            if(pool->reads != NULL)
+                SDL_CondSignal(pool->readWake); // workers run dry soon
+        }
+
+        SDL_UnlockMutex(pool->lock);
+        finished = runJob(pool, job);
+        SDL_LockMutex(pool->lock);
+
+        releaseBlock(pool, job);
+
+        if(job->kind == MEMCACHE_THUMB && !job->scheduled && --pool->lookups == 0)
+            SDL_CondSignal(pool->readWake); // batch is as big as it gets
+
+        if(!finished) {
+            job->next = pool->reads;
+            pool->reads = job;
+            pool->readCount++;
+            SDL_CondSignal(pool->readWake);
+            continue;
+        }
+
+        job->finished = SDL_GetPerformanceCounter();
+        job->next = NULL;
+        if(pool->doneTail)
+            pool->doneTail->next = job;
+        else
+            pool->done = job;
+        pool->doneTail = job;
+        if(--pool->pending == 0)
+            SDL_CondBroadcast(pool->wake); // others are idle too
+        SDL_CondSignal(pool->finished);
+    }
+
+    SDL_UnlockMutex(pool->lock);
+
+    return 0;
+}
+
+static int compareOffset(const void *a, const void *b) {
+    JPEGRecord *p = (*(JLoadJob **)a)->jpeg, *q = (*(JLoadJob **)b)->jpeg;
+
+    if(p->archive != q->archive)
+        return p->archive - q->archive;
+
+    return (p->offset > q->offset) - (p->offset < q->offset);
+}
+
+// Read archive from start to end for jobs and hand them to workers
+static void readRun(JPool *pool, JLoadJob **jobs, int count, Sint64 start, Sint64 end) {
+    struct JReadBlock *block = NULL;
+    JZFile *zip = catalog_open(pool->catalog, jobs[0]->jpeg);
+    Uint64 read = SDL_GetPerformanceCounter();
+    size_t size;
+    long got;
+    int i;
+
+    if(zip != NULL && jzfile_mapping(zip, &size) != NULL)
+        jzfile_advise(zip, start, end - start); // workers decode in place
+    else if(zip != NULL && (block = (struct JReadBlock *)malloc(sizeof(struct JReadBlock) + end - start)) != NULL) {
+        block->pool = pool;
+        block->refs = 0;
+        block->size = (long)(end - start);
+        got = readArchive(zip, start, block->data, block->size);
+        read = SDL_GetPerformanceCounter() - read;
+
+        for(i = 0; i < count; i++) // ones that didn't fit are read the usual way
+            if((jobs[i]->raw = findEntryData(block->data, got, start, jobs[i]->jpeg)) != NULL) {
+                jobs[i]->times.read = read; // whole run, that's what each waited for
+                jobs[i]->block = block;
+                block->refs++;
+            }
+
+        if(!block->refs) {
+            free(block);
+            block = NULL;
+        }
+    }
+
+    if(zip != NULL)
+        catalog_release(pool->catalog, jobs[0]->jpeg);
+
+    SDL_LockMutex(pool->lock);
+    if(block != NULL)
+        pool->buffered += block->size;
+    for(i = 0; i < count; i++) { // still in offset order
+        jobs[i]->scheduled = 1;
+        queueJob(pool, jobs[i]);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+static int reader(void *data) {
+    JPool *pool = (JPool *)data;
+    JLoadJob *jobs[READ_BATCH];
+    Sint64 end;
+    int count, i, j;
+
+    trace_thread("reader");
+
+    SDL_LockMutex(pool->lock);
+
+    while(!pool->quit) {
+        // Wait for workers to finish lookups so there's more to sort, but
+        // not when they have nothing else to do
+        if(pool->reads == NULL || pool->buffered >= READ_BUFFERED ||
+                (pool->lookups && pool->readCount < READ_BATCH && pool->queue != NULL)) {
+            SDL_CondWait(pool->readWake, pool->lock);
+            continue;
+        }
+
+        for(count = 0; count < READ_BATCH && pool->reads != NULL; count++) {
+            jobs[count] = pool->reads;
+            pool->reads = pool->reads->next;
+        }
+        pool->readCount -= count;
+
+        SDL_UnlockMutex(pool->lock);
+
+        qsort(jobs, count, sizeof(JLoadJob *), compareOffset);
+
+        for(i = 0; i < count; i = j) { // merge entries close enough together
+            end = entryEnd(jobs[i]->jpeg);
+            for(j = i + 1; j < count && jobs[j]->jpeg->archive == jobs[i]->jpeg->archive &&
+                    jobs[j]->jpeg->offset <= end + READ_GAP &&
+                    entryEnd(jobs[j]->jpeg) - jobs[i]->jpeg->offset <= READ_MAX; j++)
+                end = MAX(end, entryEnd(jobs[j]->jpeg));
+            readRun(pool, jobs + i, j - i, jobs[i]->jpeg->offset, end);
+        }
+
+        SDL_LockMutex(pool->lock);
+    }
+
+    SDL_UnlockMutex(pool->lock);
+
+    return 0;
+}
+
+JPool *create_pool(JCatalog *catalog, int threads) {
+    JPool *pool = (JPool *)calloc(1, sizeof(JPool));
+    int i;
+
+    if(pool == NULL)
+        return NULL;
+
+    if(threads < 1)
+        threads = 1;
+
+    pool->catalog = catalog;
+    pool->lock = SDL_CreateMutex();
+    pool->wake = SDL_CreateCond();
+    pool->finished = SDL_CreateCond();
+    pool->readWake = SDL_CreateCond();
+    pool->threads = (SDL_Thread **)calloc(threads, sizeof(SDL_Thread *));
+
+    if(!pool->lock || !pool->wake || !pool->finished || !pool->readWake || !pool->threads ||
+            (pool->reader = SDL_CreateThread(reader, "reader", pool)) == NULL) {
+        destroy_pool(pool);
+        return NULL;
+    }
+
+    for(i = 0; i < threads; i++) {
+        if((pool->threads[i] = SDL_CreateThread(worker, "loader", pool)) == NULL)
+            break;
+        pool->count++;
+    }
+
+    if(!pool->count) {
+        destroy_pool(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void destroy_jobs(JLoadJob *job) {
+    JLoadJob *next;
+
+    for(; job != NULL; job = next) {
+        next = job->next;
+        if(job->block != NULL) {
+            SDL_LockMutex(job->block->pool->lock);
+            releaseBlock(job->block->pool, job);
+            SDL_UnlockMutex(job->block->pool->lock);
+        }
+        if(job->image != NULL)
+            destroy_image(job->image);
+        free(job);
+    }
+}
+
+void destroy_pool(JPool *pool) {
+    int i;
+
+    if(pool->lock) {
+        SDL_LockMutex(pool->lock);
+        pool->quit = 1;
+        if(pool->wake)
+            SDL_CondBroadcast(pool->wake);
+        if(pool->readWake)
+            SDL_CondSignal(pool->readWake);
+        SDL_UnlockMutex(pool->lock);
+    }
+
+    for(i = 0; i < pool->count; i++)
+        SDL_WaitThread(pool->threads[i], NULL);
+    if(pool->reader)
+        SDL_WaitThread(pool->reader, NULL); // its last run goes to queue
+
+    destroy_jobs(pool->queue);
+    destroy_jobs(pool->done);
+    destroy_jobs(pool->reads);
+
+    if(pool->readWake) SDL_DestroyCond(pool->readWake);
+    if(pool->finished) SDL_DestroyCond(pool->finished);
+    if(pool->wake) SDL_DestroyCond(pool->wake);
+    if(pool->lock) SDL_DestroyMutex(pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+void pool_submit(JPool *pool, int index, JPEGRecord *jpeg, int kind, int w, int h, int generation) {
+    JLoadJob *job = (JLoadJob *)calloc(1, sizeof(JLoadJob));
+
+    if(job == NULL)
+        return; // will be retried by caller on next pass
+
+    job->index = index;
+    job->jpeg = jpeg;
+    job->kind = kind;
+    job->w = w;
+    job->h = h;
+    job->generation = generation;
+
+    pool_submit_job(pool, job);
+}
+
+void pool_submit_job(JPool *pool, JLoadJob *job) {
+    job->submitted = SDL_GetPerformanceCounter();
+
+    SDL_LockMutex(pool->lock);
+    queueJob(pool, job);
+    if(job->kind == MEMCACHE_THUMB)
+        pool->lookups++;
+    pool->pending++;
+    SDL_UnlockMutex(pool->lock);
+}
+
+JLoadJob *pool_collect(JPool *pool) {
+    JLoadJob *job;
+
+    SDL_LockMutex(pool->lock);
+    if((job = pool->done) != NULL) {
+        if((pool->done = job->next) == NULL)
+            pool->doneTail = NULL;
+        job->next = NULL;
+    }
+    SDL_UnlockMutex(pool->lock);
+
+    return job;
+}
+
+JLoadJob *pool_cancel(JPool *pool, int kind) {
+    JLoadJob *job, *list = NULL, **prev;
+
+    SDL_LockMutex(pool->lock);
+    pool->queueTail = NULL;
+    for(prev = &pool->queue; (job = *prev) != NULL; ) {
+        if(kind < 0 || job->kind == kind) {
+            *prev = job->next;
+            job->next = list;
+            list = job;
+            pool->pending--;
+            if(job->kind == MEMCACHE_THUMB && !job->scheduled)
+                pool->lookups--;
+        } else {
+            pool->queueTail = job;
+            prev = &job->next;
+        }
+    }
+    if(kind < 0 || kind == MEMCACHE_THUMB) { // ones being read now still get done
+        while((job = pool->reads) != NULL) {
+            pool->reads = job->next;
+            job->next = list;
+            list = job;
+            pool->pending--;
+        }
+        pool->readCount = 0;
+    }
+    if(!pool->pending)
+        SDL_CondBroadcast(pool->wake); // workers can give scratch memory back
+    SDL_CondSignal(pool->readWake);
+    SDL_UnlockMutex(pool->lock);
+
+    return list;
+}
+
+void pool_wait(JPool *pool, Uint32 timeout) {
+    SDL_LockMutex(pool->lock);
+    if(pool->done == NULL && pool->pending)
+        SDL_CondWaitTimeout(pool->finished, pool->lock, timeout);
+    SDL_UnlockMutex(pool->lock);
+}
+
+int pool_pending(JPool *pool) {
+    int pending;
+
+    SDL_LockMutex(pool->lock);
+    pending = pool->pending;
+    SDL_UnlockMutex(pool->lock);
+
+    return pending;
+}
+
+int pool_reads(JPool *pool, long long *buffered) {
+    int reads;
+
+    SDL_LockMutex(pool->lock);
+    reads = pool->readCount;
+    *buffered = pool->buffered;
+    SDL_UnlockMutex(pool->lock);
+
+    return reads;
+}
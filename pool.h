@@ -0,0 +1,117 @@
+/**
+ * Thumbnail worker pool.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __POOL_H
+#define __POOL_H
+
+#include "SDL2/SDL.h"
+
+#include "catalog.h"
+#include "image.h"
+#include "loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Thumbnails that miss the disk cache go to a reader thread that sorts them
+ * by archive offset and reads runs of nearby entries with one large read
+ * each, so the disk sees sequential reads instead of a seek per entry. The
+ * reader takes what has piled up whenever workers run out of other jobs.
+ * Workers then look for an EXIF thumbnail in the shared JReadBlock, and
+ * decode the whole entry from it if there's none. Mapped archives aren't
+ * copied, the kernel is just told to read the run ahead. Runs never span
+ * archives, and entries bigger than READ_MAX are streamed instead.
+ */
+
+struct JReadBlock; // archive bytes shared by jobs, see pool.c
+
+typedef struct JLoadJob {
+    int index; // entry index, caller's business
+    JPEGRecord *jpeg;
+    int kind; // MEMCACHE_THUMB, _FULLSCREEN, _FULLSIZE or _TILE
+    int w, h; // target size, or region size for tiles
+    int level, x, y; // tile region, see loadRegionFromZip()
+    int generation; // caller can use this to discard stale results
+    JImage *image; // result, NULL if load failed
+    int scheduled; // been through the reader thread
+    const unsigned char *raw; // compressed entry data read ahead, or NULL
+    struct JReadBlock *block; // holds raw
+    JLoadTimes times; // stages of full decodes, zero for other loads
+    Uint64 submitted, finished; // SDL_GetPerformanceCounter() ticks
+    struct JLoadJob *next;
+} JLoadJob;
+
+typedef struct {
+    JCatalog *catalog; // archives and their thumbnail caches
+    SDL_Thread **threads;
+    int count;
+    SDL_mutex *lock;
+    SDL_cond *wake, *finished;
+    JLoadJob *queue, *queueTail; // waiting for a worker
+    JLoadJob *done, *doneTail; // completed, waiting for collection
+    SDL_Thread *reader;
+    SDL_cond *readWake;
+    JLoadJob *reads; // thumbnails waiting for the reader
+    int readCount;
+    int lookups; // thumbnails queued or running that may still go to reads
+    long long buffered; // bytes in read blocks not yet decoded
+    int pending; // queued, being read or being worked on
+    int quit;
+} JPool;
+
+JPool *create_pool(JCatalog *catalog, int threads);
+
+// Waits for running jobs to finish, frees everything not collected
+void destroy_pool(JPool *pool);
+
+// Queue loading of given entry at given size. Thumbnails go through the disk
+// cache and to the back of the queue, other kinds ahead of thumbnails.
+void pool_submit(JPool *pool, int index, JPEGRecord *jpeg, int kind, int w, int h, int generation);
+
+// Queue a job filled in by caller (calloc'd, pool frees it), e.g. for tiles
+void pool_submit_job(JPool *pool, JLoadJob *job);
+
+// Returns next completed job (caller frees it) or NULL if none ready
+JLoadJob *pool_collect(JPool *pool);
+
+// Drops jobs of given kind (-1 for all) not yet started, returns them for
+// caller to free
+JLoadJob *pool_cancel(JPool *pool, int kind);
+
+// Frees a list of jobs, including any result images
+void destroy_jobs(JLoadJob *job);
+
+// Sleep until something completes or timeout (ms) expires
+void pool_wait(JPool *pool, Uint32 timeout);
+
+int pool_pending(JPool *pool);
+
+// Thumbnails waiting for the reader thread, bytes read ahead for workers
+// to *buffered
+int pool_reads(JPool *pool, long long *buffered);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
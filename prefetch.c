@@ -0,0 +1,189 @@
+/**
+ * Background loading of neighbouring images in fullscreen mode.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prefetch.h"
+
+#define FULLSCREEN_BIT MEMCACHE_BIT(MEMCACHE_FULLSCREEN)
+
+JPrefetch *create_prefetch(JPool *pool, JMemCache *cache, JCatalog *catalog, int count, int ahead) {
+    JPrefetch *prefetch = (JPrefetch *)calloc(1, sizeof(JPrefetch));
+    int i;
+
+    if(prefetch == NULL)
+        return NULL;
+
+    prefetch->pool = pool;
+    prefetch->cache = cache;
+    prefetch->catalog = catalog;
+    prefetch->count = count;
+    prefetch->ahead = (ahead < 1) ? 1 : (ahead > PREFETCH_MAX - 2) ? PREFETCH_MAX - 2 : ahead;
+    prefetch->current = -1;
+    prefetch->direction = 1;
+
+    for(i = 0; i < PREFETCH_MAX; i++)
+        prefetch->ringIndex[i] = -1;
+
+    return prefetch;
+}
+
+void destroy_prefetch(JPrefetch *prefetch) {
+    prefetch_stop(prefetch);
+    free(prefetch);
+}
+
+// Queued loads are for the old position, caller requeues what's still wanted
+static void cancelQueued(JPrefetch *prefetch) {
+    JLoadJob *job, *list = pool_cancel(prefetch->pool, MEMCACHE_FULLSCREEN);
+
+    for(job = list; job != NULL; job = job->next)
+        job->jpeg->queued &= ~FULLSCREEN_BIT;
+
+    destroy_jobs(list);
+}
+
+void prefetch_update(JPrefetch *prefetch, int index, int w, int h, int generation) {
+    int wanted[PREFETCH_MAX];
+    JMemCacheItem *items[PREFETCH_MAX];
+    JPEGRecord *jpeg;
+    Uint32 now = SDL_GetTicks();
+    int i, j, n = 0, ahead, step, sameSize;
+    double rate;
+
+    sameSize = (w == prefetch->w && h == prefetch->h && generation == prefetch->generation);
+
+    if(index == prefetch->current && sameSize && !prefetch->stale)
+        return;
+
+    if(prefetch->current >= 0 && index != prefetch->current) {
+        step = index - prefetch->current;
+        if((step > 0) != (prefetch->direction > 0)) { // reversed, start slow
+            prefetch->direction = (step > 0) ? 1 : -1;
+            prefetch->speed = 0.0;
+        } else {
+            rate = abs(step) * 1000.0 / ((now > prefetch->lastStep) ? now - prefetch->lastStep : 1);
+            prefetch->speed = (prefetch->speed + rate) / 2;
+        }
+        prefetch->lastStep = now;
+    } else if(prefetch->current < 0)
+        prefetch->lastStep = now;
+
+    // Decodes take a few hundred ms, at 4 images/s we need two more in flight
+    ahead = 2 + (int)(prefetch->speed / 2);
+    if(ahead > prefetch->ahead)
+        ahead = prefetch->ahead;
+
+    // In priority order: current, ahead in travel direction, one behind
+    wanted[n++] = index;
+    for(i = 1; i <= ahead; i++)
+        wanted[n++] = index + i * prefetch->direction;
+    wanted[n++] = index - prefetch->direction;
+
+    cancelQueued(prefetch);
+
+    for(i = 0; i < n; i++) {
+        items[i] = NULL;
+
+        if(wanted[i] < 0 || wanted[i] >= prefetch->count) {
+            wanted[i] = -1;
+            continue;
+        }
+
+        for(j = 0; sameSize && j < PREFETCH_MAX; j++) { // already pinned?
+            if(prefetch->ringIndex[j] == wanted[i] && prefetch->ringItem[j] != NULL) {
+                items[i] = prefetch->ringItem[j];
+                prefetch->ringItem[j] = NULL;
+                break;
+            }
+        }
+
+        jpeg = catalog_entry(prefetch->catalog, wanted[i]);
+        if(items[i] != NULL || ((jpeg->failed | jpeg->queued) & FULLSCREEN_BIT))
+            continue; // loaded, hopeless or already being loaded
+
+        if(memcache_contains(prefetch->cache, jpeg, MEMCACHE_FULLSCREEN))
+            items[i] = memcache_get(prefetch->cache, jpeg, MEMCACHE_FULLSCREEN);
+        else {
+            pool_submit(prefetch->pool, wanted[i], jpeg, MEMCACHE_FULLSCREEN, w, h, generation);
+            jpeg->queued |= FULLSCREEN_BIT;
+        }
+    }
+
+    for(j = 0; j < PREFETCH_MAX; j++) { // unpin what's no longer wanted
+        memcache_release(prefetch->cache, prefetch->ringItem[j]);
+        prefetch->ringItem[j] = (j < n) ? items[j] : NULL;
+        prefetch->ringIndex[j] = (j < n) ? wanted[j] : -1;
+    }
+
+    prefetch->current = index;
+    prefetch->w = w;
+    prefetch->h = h;
+    prefetch->generation = generation;
+    prefetch->stale = 0;
+}
+
+void prefetch_collect(JPrefetch *prefetch, JLoadJob *job) {
+    JMemCacheItem *item;
+    int i;
+
+    job->jpeg->queued &= ~FULLSCREEN_BIT;
+
+    for(i = 0; i < PREFETCH_MAX; i++)
+        if(prefetch->ringIndex[i] == job->index)
+            break;
+
+    if(job->generation != prefetch->generation || job->w != prefetch->w || job->h != prefetch->h) {
+        if(i < PREFETCH_MAX) // wanted but for old size, load again
+            prefetch->stale = 1;
+        return;
+    }
+
+    if(job->image == NULL) {
+        job->jpeg->failed |= FULLSCREEN_BIT;
+        return;
+    }
+
+    if((item = memcache_put_image(prefetch->cache, job->jpeg, MEMCACHE_FULLSCREEN, job->image)) == NULL)
+        return;
+    job->image = NULL; // owned by cache now
+
+    if(i < PREFETCH_MAX && prefetch->ringItem[i] == NULL)
+        prefetch->ringItem[i] = item;
+    else // moved on already, but keep it cached for coming back
+        memcache_release(prefetch->cache, item);
+}
+
+void prefetch_stop(JPrefetch *prefetch) {
+    int i;
+
+    cancelQueued(prefetch);
+
+    for(i = 0; i < PREFETCH_MAX; i++) {
+        memcache_release(prefetch->cache, prefetch->ringItem[i]);
+        prefetch->ringItem[i] = NULL;
+        prefetch->ringIndex[i] = -1;
+    }
+
+    prefetch->current = -1;
+    prefetch->speed = 0.0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Background loading of neighbouring images in fullscreen mode.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __PREFETCH_H
+#define __PREFETCH_H
+
+#include "SDL2/SDL.h"
+
+#include "catalog.h"
+#include "loader.h"
+#include "memcache.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Keeps the current image, up to `ahead` images in the direction of travel
+ * and one behind loaded at screen size as MEMCACHE_FULLSCREEN items, pinned
+ * so they survive cache pressure. The faster the user steps, the further
+ * ahead we go. Everything runs in the main thread, loading is done by the
+ * pool.
+ */
+
+#define PREFETCH_MAX 16 // ring slots, ahead + current + one behind
+
+typedef struct {
+    JPool *pool;
+    JMemCache *cache;
+    JCatalog *catalog;
+    int count; // entries indexed so far
+    int ahead; // most images to load in travel direction
+
+    int ringIndex[PREFETCH_MAX]; // wanted entries, -1 for unused slots
+    JMemCacheItem *ringItem[PREFETCH_MAX]; // pinned once loaded
+
+    int current, direction; // direction is 1 or -1
+    double speed; // images per second, smoothed
+    Uint32 lastStep; // SDL_GetTicks() of last move
+    int w, h, generation; // what the current ring was requested with
+    int stale; // requeue even if position didn't change
+} JPrefetch;
+
+JPrefetch *create_prefetch(JPool *pool, JMemCache *cache, JCatalog *catalog, int count, int ahead);
+
+void destroy_prefetch(JPrefetch *prefetch);
+
+// Call with current fullscreen image, cheap if nothing changed
+void prefetch_update(JPrefetch *prefetch, int index, int w, int h, int generation);
+
+// Hand over a completed MEMCACHE_FULLSCREEN job, caller still frees it
+void prefetch_collect(JPrefetch *prefetch, JLoadJob *job);
+
+// Drop queued loads and unpin everything, e.g. when leaving fullscreen
+void prefetch_stop(JPrefetch *prefetch);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
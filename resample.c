@@ -0,0 +1,381 @@
+/**
+ * Separable image resampling with SIMD kernels.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resample.h"
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * Two passes: each source row is filtered horizontally into 16 bits per
+ * channel (7 extra fraction bits), then rows are combined vertically.
+ * Weights are 14-bit fixed point, so every product and sum fits the
+ * signed 16x16->32 bit multiply-add of SSE2/AVX2 exactly, and the SIMD
+ * kernels produce the same bytes as the scalar ones.
+ */
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define TEMP_BITS 7
+#define FINAL_SHIFT (WEIGHT_BITS + TEMP_BITS)
+
+typedef struct {
+    int taps; // weights per output, zero padded
+    int *start; // first source pixel per output
+    Sint16 *weight; // taps per output, summing to WEIGHT_ONE
+} JFilter;
+
+// Horizontal pass: count output pixels from 32-bit source into 4 x 16 bits
+typedef void (*JHorizontalFunc)(Uint16 *dest, const Uint32 *src, const JFilter *f, int count);
+// Vertical pass: combine taps temp rows into dest pixels from..count-1
+typedef void (*JVerticalFunc)(Uint32 *dest, Uint16 **rows, const Sint16 *weight, int taps, int from, int count);
+
+static int freeFilter(JFilter *f) {
+    free(f->start);
+    free(f->weight);
+    return -1;
+}
+
+// Build weight table for scaling srcN pixels into dstN
+static int makeFilter(JFilter *f, int srcN, int dstN) {
+    double s = (double)srcN / dstN, left, right, center, w;
+    double *tmp;
+    int i, k, first, last, sum, big, taps;
+
+    taps = (s >= 2.0) ? (int)ceil(s) + 1 : 2;
+    if(taps > srcN)
+        taps = srcN;
+
+    f->taps = taps;
+    f->start = (int *)malloc(dstN * sizeof(int));
+    f->weight = (Sint16 *)calloc((size_t)dstN * taps, sizeof(Sint16));
+    tmp = (double *)malloc(taps * sizeof(double));
+
+    if(f->start == NULL || f->weight == NULL || tmp == NULL) {
+        free(tmp);
+        return freeFilter(f);
+    }
+
+    for(i = 0; i < dstN; i++) {
+        for(k = 0; k < taps; k++)
+            tmp[k] = 0.0;
+
+        if(s >= 2.0) { // box, weight = coverage of source pixel
+            left = i * s;
+            right = left + s;
+            first = (int)left;
+            last = (int)ceil(right) - 1;
+            if(last >= srcN)
+                last = srcN - 1;
+            if(first > srcN - taps)
+                first = srcN - taps;
+            f->start[i] = first;
+            for(k = first; k <= last && k - first < taps; k++) {
+                w = MIN(right, k + 1.0) - MAX(left, (double)k);
+                tmp[k - first] = (w > 0.0) ? w / s : 0.0;
+            }
+        } else { // bilinear, pixel centers aligned
+            center = (i + 0.5) * s - 0.5;
+            if(center < 0.0)
+                center = 0.0;
+            if(center > srcN - 1)
+                center = srcN - 1;
+            first = (int)center;
+            w = center - first;
+            if(first > srcN - taps) { // right edge
+                first = srcN - taps;
+                w += 1.0;
+            }
+            f->start[i] = first;
+            tmp[0] = 1.0 - w;
+            if(taps > 1)
+                tmp[1] = w;
+        }
+
+        // Quantize, giving rounding residue to the biggest weight
+        for(k = 0, sum = 0, big = 0; k < taps; k++) {
+            f->weight[i * taps + k] = (Sint16)floor(tmp[k] * WEIGHT_ONE + 0.5);
+            sum += f->weight[i * taps + k];
+            if(tmp[k] > tmp[big])
+                big = k;
+        }
+        f->weight[i * taps + big] += WEIGHT_ONE - sum;
+    }
+
+    free(tmp);
+    return 0;
+}
+
+static void horizontal_scalar(Uint16 *dest, const Uint32 *src, const JFilter *f, int count) {
+    const unsigned char *p;
+    const Sint16 *w;
+    int i, k, c, sum;
+
+    for(i = 0; i < count; i++) {
+        p = (const unsigned char *)(src + f->start[i]);
+        w = f->weight + i * f->taps;
+        for(c = 0; c < 4; c++) {
+            for(k = 0, sum = 0; k < f->taps; k++)
+                sum += w[k] * p[k * 4 + c];
+            dest[i * 4 + c] = (Uint16)((sum + (1 << (TEMP_BITS - 1))) >> TEMP_BITS);
+        }
+    }
+}
+
+static void vertical_scalar(Uint32 *dest, Uint16 **rows, const Sint16 *weight, int taps, int from, int count) {
+    unsigned char *out = (unsigned char *)dest;
+    int i, k, sum;
+
+    for(i = from * 4; i < count * 4; i++) {
+        for(k = 0, sum = 0; k < taps; k++)
+            sum += weight[k] * rows[k][i];
+        out[i] = (unsigned char)((sum + (1 << (FINAL_SHIFT - 1))) >> FINAL_SHIFT);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// Two neighbouring pixels as [b0 b1 g0 g1 r0 r1 a0 a1] 16-bit lanes
+__attribute__((target("sse2")))
+static inline __m128i pixelPair(__m128i x) {
+    x = _mm_unpacklo_epi8(x, _mm_setzero_si128());
+    return _mm_unpacklo_epi16(x, _mm_srli_si128(x, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i weightPair(const Sint16 *w, int second) {
+    return _mm_set1_epi32((int)(Uint16)w[0] | (second ? (int)w[1] << 16 : 0));
+}
+
+__attribute__((target("sse2")))
+static void horizontal_sse2(Uint16 *dest, const Uint32 *src, const JFilter *f, int count) {
+    const Uint32 *p;
+    const Sint16 *w;
+    __m128i sum, round = _mm_set1_epi32(1 << (TEMP_BITS - 1));
+    int i, k;
+
+    for(i = 0; i < count; i++) {
+        p = src + f->start[i];
+        w = f->weight + i * f->taps;
+        sum = round;
+        for(k = 0; k + 1 < f->taps; k += 2)
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(
+                        pixelPair(_mm_loadl_epi64((const __m128i *)(p + k))), weightPair(w + k, 1)));
+        if(k < f->taps) // odd tap, load just one pixel so we don't read past the row
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(
+                        pixelPair(_mm_cvtsi32_si128((int)p[k])), weightPair(w + k, 0)));
+        sum = _mm_srai_epi32(sum, TEMP_BITS);
+        _mm_storel_epi64((__m128i *)(dest + i * 4), _mm_packs_epi32(sum, sum));
+    }
+}
+
+__attribute__((target("sse2")))
+static void vertical_sse2(Uint32 *dest, Uint16 **rows, const Sint16 *weight, int taps, int from, int count) {
+    __m128i round = _mm_set1_epi32(1 << (FINAL_SHIFT - 1)), zero = _mm_setzero_si128();
+    __m128i a, b, w, s0, s1, s2, s3;
+    int i, k;
+
+    for(i = from; i + 4 <= count; i += 4) { // 4 pixels = 16 channels per round
+        s0 = s1 = s2 = s3 = round;
+        for(k = 0; k < taps; k += 2) {
+            w = weightPair(weight + k, k + 1 < taps);
+            a = _mm_loadu_si128((const __m128i *)(rows[k] + i * 4));
+            b = (k + 1 < taps) ? _mm_loadu_si128((const __m128i *)(rows[k+1] + i * 4)) : zero;
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+            a = _mm_loadu_si128((const __m128i *)(rows[k] + i * 4 + 8));
+            b = (k + 1 < taps) ? _mm_loadu_si128((const __m128i *)(rows[k+1] + i * 4 + 8)) : zero;
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        s0 = _mm_packs_epi32(_mm_srai_epi32(s0, FINAL_SHIFT), _mm_srai_epi32(s1, FINAL_SHIFT));
+        s2 = _mm_packs_epi32(_mm_srai_epi32(s2, FINAL_SHIFT), _mm_srai_epi32(s3, FINAL_SHIFT));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(s0, s2));
+    }
+
+    vertical_scalar(dest, rows, weight, taps, i, count); // leftover pixels
+}
+
+__attribute__((target("avx2")))
+static void horizontal_avx2(Uint16 *dest, const Uint32 *src, const JFilter *f, int count) {
+    const Uint32 *p, *q;
+    const Sint16 *w, *v;
+    __m256i sum, x, round = _mm256_set1_epi32(1 << (TEMP_BITS - 1)), zero = _mm256_setzero_si256();
+    int i, k;
+
+    for(i = 0; i + 2 <= count; i += 2) { // one output pixel per 128-bit lane
+        p = src + f->start[i];
+        q = src + f->start[i+1];
+        w = f->weight + i * f->taps;
+        v = w + f->taps;
+        sum = round;
+        for(k = 0; k + 1 < f->taps; k += 2) {
+            x = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                        _mm_loadl_epi64((const __m128i *)(p + k))),
+                    _mm_loadl_epi64((const __m128i *)(q + k)), 1);
+            x = _mm256_unpacklo_epi8(x, zero);
+            x = _mm256_unpacklo_epi16(x, _mm256_srli_si256(x, 8));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(x, _mm256_inserti128_si256(
+                            _mm256_castsi128_si256(weightPair(w + k, 1)), weightPair(v + k, 1), 1)));
+        }
+        if(k < f->taps) {
+            x = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                        _mm_cvtsi32_si128((int)p[k])), _mm_cvtsi32_si128((int)q[k]), 1);
+            x = _mm256_unpacklo_epi8(x, zero);
+            x = _mm256_unpacklo_epi16(x, _mm256_srli_si256(x, 8));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(x, _mm256_inserti128_si256(
+                            _mm256_castsi128_si256(weightPair(w + k, 0)), weightPair(v + k, 0), 1)));
+        }
+        sum = _mm256_srai_epi32(sum, TEMP_BITS);
+        sum = _mm256_packs_epi32(sum, sum);
+        _mm_storel_epi64((__m128i *)(dest + i * 4), _mm256_castsi256_si128(sum));
+        _mm_storel_epi64((__m128i *)(dest + i * 4 + 4), _mm256_extracti128_si256(sum, 1));
+    }
+
+    if(i < count) {
+        JFilter tail = { f->taps, f->start + i, f->weight + i * f->taps };
+        horizontal_sse2(dest + i * 4, src, &tail, count - i);
+    }
+}
+
+__attribute__((target("avx2")))
+static void vertical_avx2(Uint32 *dest, Uint16 **rows, const Sint16 *weight, int taps, int from, int count) {
+    __m256i round = _mm256_set1_epi32(1 << (FINAL_SHIFT - 1)), zero = _mm256_setzero_si256();
+    __m256i a, b, w, s0, s1, s2, s3;
+    int i, k;
+
+    for(i = from; i + 8 <= count; i += 8) { // 8 pixels = 32 channels per round
+        s0 = s1 = s2 = s3 = round;
+        for(k = 0; k < taps; k += 2) {
+            w = _mm256_broadcastsi128_si256(weightPair(weight + k, k + 1 < taps));
+            a = _mm256_loadu_si256((const __m256i *)(rows[k] + i * 4));
+            b = (k + 1 < taps) ? _mm256_loadu_si256((const __m256i *)(rows[k+1] + i * 4)) : zero;
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+            a = _mm256_loadu_si256((const __m256i *)(rows[k] + i * 4 + 16));
+            b = (k + 1 < taps) ? _mm256_loadu_si256((const __m256i *)(rows[k+1] + i * 4 + 16)) : zero;
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        // Packs work within 128-bit lanes, which undoes the unpacks above
+        s0 = _mm256_packs_epi32(_mm256_srai_epi32(s0, FINAL_SHIFT), _mm256_srai_epi32(s1, FINAL_SHIFT));
+        s2 = _mm256_packs_epi32(_mm256_srai_epi32(s2, FINAL_SHIFT), _mm256_srai_epi32(s3, FINAL_SHIFT));
+        _mm256_storeu_si256((__m256i *)(dest + i),
+                _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s2), 0xD8));
+    }
+
+    vertical_sse2(dest, rows, weight, taps, i, count);
+}
+
+#endif // HAVE_X86_SIMD
+
+static int kernel = -1; // not detected yet
+
+static int bestKernel(void) {
+#ifdef HAVE_X86_SIMD
+    if(SDL_HasAVX2())
+        return RESAMPLE_AVX2;
+    if(SDL_HasSSE2())
+        return RESAMPLE_SSE2;
+#endif
+    return RESAMPLE_SCALAR;
+}
+
+int resample_set_kernel(int k) {
+    int best = bestKernel();
+
+    kernel = (k < best) ? k : best;
+    return kernel;
+}
+
+const char *resample_kernel_name(int k) {
+    static const char *names[RESAMPLE_KERNELS] = { "scalar", "sse2", "avx2" };
+    return (k >= 0 && k < RESAMPLE_KERNELS) ? names[k] : "unknown";
+}
+
+JImage *resample_image(JImage *src, int w, int h) {
+    JHorizontalFunc horizontal = horizontal_scalar;
+    JVerticalFunc vertical = vertical_scalar;
+    JFilter fx = { 0, NULL, NULL }, fy = { 0, NULL, NULL };
+    Uint16 *ring = NULL, **rows = NULL;
+    int *ringRow = NULL;
+    JImage *res = NULL;
+    int i, j, k, row;
+
+    if(kernel < 0)
+        kernel = bestKernel();
+
+#ifdef HAVE_X86_SIMD
+    if(kernel == RESAMPLE_AVX2) {
+        horizontal = horizontal_avx2;
+        vertical = vertical_avx2;
+    } else if(kernel == RESAMPLE_SSE2) {
+        horizontal = horizontal_sse2;
+        vertical = vertical_sse2;
+    }
+#endif
+
+    if(w < 1 || h < 1 || src->w < 1 || src->h < 1)
+        return NULL;
+
+    if(makeFilter(&fx, src->w, w) || makeFilter(&fy, src->h, h))
+        goto RESAMPLE_DONE;
+
+    // Ring of horizontally filtered rows, source rows needed only go forward
+    ring = (Uint16 *)malloc((size_t)fy.taps * w * 4 * sizeof(Uint16));
+    ringRow = (int *)malloc(fy.taps * sizeof(int));
+    rows = (Uint16 **)malloc(fy.taps * sizeof(Uint16 *));
+
+    if(ring == NULL || ringRow == NULL || rows == NULL || (res = create_image(w, h)) == NULL)
+        goto RESAMPLE_DONE;
+
+    for(k = 0; k < fy.taps; k++)
+        ringRow[k] = -1;
+
+    for(j = 0; j < h; j++) {
+        for(k = 0; k < fy.taps; k++) {
+            row = fy.start[j] + k;
+            i = row % fy.taps;
+            rows[k] = ring + (size_t)i * w * 4;
+            if(ringRow[i] != row) {
+                horizontal(rows[k], src->data + (size_t)row * src->w, &fx, w);
+                ringRow[i] = row;
+            }
+        }
+        vertical(res->data + (size_t)j * w, rows, fy.weight + j * fy.taps, fy.taps, 0, w);
+    }
+
+RESAMPLE_DONE:
+    free(rows);
+    free(ringRow);
+    free(ring);
+    freeFilter(&fx);
+    freeFilter(&fy);
+
+    return res;
+}
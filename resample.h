@@ -0,0 +1,50 @@
+/**
+ * Separable image resampling with SIMD kernels.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __RESAMPLE_H
+#define __RESAMPLE_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// Kernel sets, resample_image picks the best one the CPU has by default
+enum { RESAMPLE_SCALAR, RESAMPLE_SSE2, RESAMPLE_AVX2, RESAMPLE_KERNELS };
+
+// Resize to exactly w * h. Ratios of 2 or more use area averaging (box
+// filter), smaller ones bilinear. All kernels give bit-identical results.
+JImage *resample_image(JImage *src, int w, int h);
+
+// Force a kernel set, for testing. Returns the set actually used, which is
+// lower if the CPU doesn't support the requested one. Not thread safe.
+int resample_set_kernel(int kernel);
+
+const char *resample_kernel_name(int kernel);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
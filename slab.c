@@ -0,0 +1,333 @@
+/**
+ * Slab allocation of same size images, and per thread scratch images.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#if !defined _WIN32 && !defined _WIN64
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+static SDL_mutex *slabLock = NULL;
+static SDL_TLSID scratchKey = 0;
+static int useHuge = 0;
+static size_t slotBytes = 0; // current slot size, 0 for no slabs
+static JSlab *partial = NULL; // slabs of slotBytes with free slots
+static JSlabStats stats;
+
+static void *allocMemory(size_t bytes, int *huge) {
+    void *memory;
+#if !defined _WIN32 && !defined _WIN64 && defined MADV_HUGEPAGE
+    unsigned char *p, *aligned;
+
+    if(*huge) { // map extra so a huge page aligned range can be cut out
+        if((p = (unsigned char *)mmap(NULL, bytes + SLAB_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+            aligned = p + (SLAB_HUGE_PAGE - (size_t)p % SLAB_HUGE_PAGE) % SLAB_HUGE_PAGE;
+            if(aligned > p)
+                munmap(p, aligned - p);
+            munmap(aligned + bytes, p + SLAB_HUGE_PAGE - aligned);
+            madvise(aligned, bytes, MADV_HUGEPAGE);
+            return aligned;
+        }
+    }
+#endif
+
+    *huge = 0;
+    memory = malloc(bytes);
+
+    return memory;
+}
+
+static void freeMemory(void *memory, size_t bytes, int huge) {
+#if !defined _WIN32 && !defined _WIN64 && defined MADV_HUGEPAGE
+    if(huge) {
+        munmap(memory, bytes);
+        return;
+    }
+#endif
+    (void)bytes;
+    (void)huge;
+    free(memory);
+}
+
+// New scratch memory of given size, 0 to just free the old. Returns 0 if
+// there's no memory.
+static int resizeScratch(JSlab *slab, size_t bytes) {
+    long long old = (long long)slab->bytes;
+
+    free(slab->memory);
+    slab->memory = bytes ? (unsigned char *)malloc(bytes) : NULL;
+    slab->bytes = slab->slotBytes = slab->memory ? bytes : 0;
+    slab->small = 0;
+
+    if(slabLock != NULL) {
+        SDL_LockMutex(slabLock);
+        stats.scratchBytes += (long long)slab->bytes - old;
+        stats.peakScratchBytes = MAX(stats.peakScratchBytes, stats.scratchBytes);
+        SDL_UnlockMutex(slabLock);
+    }
+
+    return slab->memory != NULL;
+}
+
+static void freeScratch(void *data) {
+    JSlab *slab = (JSlab *)data;
+
+    resizeScratch(slab, 0);
+    free(slab);
+}
+
+void init_slabs(int hugePages) {
+    if((slabLock = SDL_CreateMutex()) == NULL)
+        return;
+
+    scratchKey = SDL_TLSCreate(); // 0 if not, no scratch buffers then
+    useHuge = hugePages;
+}
+
+void quit_slabs(void) {
+    JSlab *slab;
+
+    if(slabLock == NULL)
+        return;
+
+    while((slab = partial) != NULL) { // scratch buffers go with their threads
+        partial = slab->next;
+        freeMemory(slab->memory, slab->bytes, slab->huge);
+        free(slab);
+    }
+
+    SDL_DestroyMutex(slabLock);
+    slabLock = NULL;
+    slotBytes = 0;
+}
+
+static void unlinkPartial(JSlab *slab) {
+    if(slab->prev) slab->prev->next = slab->next;
+    else partial = slab->next;
+    if(slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+    slab->partial = 0;
+}
+
+static void linkPartial(JSlab *slab) {
+    slab->prev = NULL;
+    if((slab->next = partial) != NULL)
+        partial->prev = slab;
+    partial = slab;
+    slab->partial = 1;
+}
+
+void slab_set_size(int w, int h) {
+    size_t bytes = IMAGE_HEADER + (size_t)w * h * sizeof(Uint32);
+    JSlab *slab, *next;
+
+    if(slabLock == NULL)
+        return;
+
+    SDL_LockMutex(slabLock);
+    if(bytes != slotBytes) {
+        slotBytes = bytes;
+        for(slab = partial; slab != NULL; slab = next) { // old size, let them empty out
+            next = slab->next;
+            unlinkPartial(slab);
+            if(!slab->used) {
+                stats.slabs--;
+                stats.slabBytes -= slab->bytes;
+                freeMemory(slab->memory, slab->bytes, slab->huge);
+                free(slab);
+            }
+        }
+    }
+    SDL_UnlockMutex(slabLock);
+}
+
+static JSlab *createSlab(void) {
+    JSlab *slab = (JSlab *)calloc(1, sizeof(JSlab));
+
+    if(slab == NULL)
+        return NULL;
+
+    slab->slotBytes = slotBytes;
+    slab->slots = MAX(1, (int)(SLAB_BYTES / slotBytes));
+    slab->bytes = slab->slots * slotBytes;
+    slab->huge = useHuge;
+
+    if(slab->huge) { // whole huge pages, more slots if they fit
+        slab->bytes = (slab->bytes + SLAB_HUGE_PAGE - 1) / SLAB_HUGE_PAGE * SLAB_HUGE_PAGE;
+        slab->slots = (int)(slab->bytes / slotBytes);
+    }
+
+    if((slab->memory = (unsigned char *)allocMemory(slab->bytes, &slab->huge)) == NULL) {
+        free(slab);
+        return NULL;
+    }
+
+    stats.slabs++;
+    stats.slabBytes += slab->bytes;
+    stats.peakSlabBytes = MAX(stats.peakSlabBytes, stats.slabBytes);
+
+    return slab;
+}
+
+JImage *slab_create_image(int w, int h) {
+    size_t bytes = IMAGE_HEADER + (size_t)w * h * sizeof(Uint32);
+    unsigned char *slot = NULL;
+    JImage *img;
+    JSlab *slab = NULL;
+
+    if(slabLock == NULL)
+        return NULL;
+
+    SDL_LockMutex(slabLock);
+
+    // Small ones would waste most of the slot
+    if(bytes <= slotBytes && bytes >= slotBytes / 4 && (slab = partial) == NULL &&
+            (slab = createSlab()) != NULL)
+        linkPartial(slab);
+
+    if(slab != NULL) {
+        if((slot = (unsigned char *)slab->freeSlots) != NULL)
+            slab->freeSlots = *(void **)slot;
+        else
+            slot = slab->memory + slab->fresh++ * slab->slotBytes;
+
+        if(++slab->used == slab->slots)
+            unlinkPartial(slab);
+
+        stats.slabImages++;
+        stats.slotBytes += slab->slotBytes;
+        stats.imageBytes += bytes;
+    }
+
+    SDL_UnlockMutex(slabLock);
+
+    if(slot == NULL)
+        return NULL;
+
+    img = (JImage *)slot;
+    img->data = (Uint32 *)(slot + IMAGE_HEADER);
+    img->w = w;
+    img->h = h;
+    img->slab = slab;
+
+    return img;
+}
+
+void slab_destroy_image(JImage *img) {
+    JSlab *slab = img->slab;
+
+    if(slab->scratch) { // only the owning thread touches it
+        slab->used = 0;
+        if(IMAGE_HEADER + (size_t)img->w * img->h * sizeof(Uint32) >= slab->bytes / 4)
+            slab->small = 0;
+        else if(++slab->small >= SLAB_SCRATCH_SHRINK) // kept for a bigger size than now needed
+            resizeScratch(slab, 0);
+        return;
+    }
+
+    SDL_LockMutex(slabLock);
+
+    *(void **)img = slab->freeSlots;
+    slab->freeSlots = img;
+
+    if(--slab->used == 0 && (slab->slotBytes != slotBytes || partial != slab || slab->next != NULL)) {
+        // Empty, give it back unless it's the only one left for this size
+        if(slab->partial)
+            unlinkPartial(slab);
+        stats.slabs--;
+        stats.slabBytes -= slab->bytes;
+        freeMemory(slab->memory, slab->bytes, slab->huge);
+        free(slab);
+    } else if(!slab->partial && slab->slotBytes == slotBytes)
+        linkPartial(slab);
+
+    SDL_UnlockMutex(slabLock);
+}
+
+void slab_count_malloc(void) {
+    if(slabLock == NULL)
+        return;
+
+    SDL_LockMutex(slabLock);
+    stats.mallocImages++;
+    SDL_UnlockMutex(slabLock);
+}
+
+JImage *create_scratch_image(int width, int height) {
+    size_t bytes = IMAGE_HEADER + (size_t)width * height * sizeof(Uint32);
+    JSlab *slab;
+    JImage *img;
+
+    if(!scratchKey || bytes > SLAB_SCRATCH_MAX)
+        return create_image(width, height);
+
+    if((slab = (JSlab *)SDL_TLSGet(scratchKey)) == NULL) {
+        if((slab = (JSlab *)calloc(1, sizeof(JSlab))) == NULL)
+            return create_image(width, height);
+        slab->scratch = 1;
+        slab->slots = 1;
+        SDL_TLSSet(scratchKey, slab, freeScratch);
+    }
+
+    if(slab->used) // still holding the previous one
+        return create_image(width, height);
+
+    if(slab->bytes < bytes && !resizeScratch(slab, bytes)) // grow to the largest size seen
+        return create_image(width, height);
+
+    slab->used = 1;
+
+    SDL_LockMutex(slabLock);
+    stats.scratchImages++;
+    SDL_UnlockMutex(slabLock);
+
+    img = (JImage *)slab->memory;
+    img->data = (Uint32 *)(slab->memory + IMAGE_HEADER);
+    img->w = width;
+    img->h = height;
+    img->slab = slab;
+
+    return img;
+}
+
+void slab_release_scratch(void) {
+    JSlab *slab;
+
+    if(scratchKey && (slab = (JSlab *)SDL_TLSGet(scratchKey)) != NULL &&
+            !slab->used && slab->memory != NULL)
+        resizeScratch(slab, 0);
+}
+
+void slab_stats(JSlabStats *out) {
+    if(slabLock == NULL) {
+        memset(out, 0, sizeof(JSlabStats));
+        return;
+    }
+
+    SDL_LockMutex(slabLock);
+    *out = stats;
+    SDL_UnlockMutex(slabLock);
+}
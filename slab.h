@@ -0,0 +1,110 @@
+/**
+ * Slab allocation of same size images, and per thread scratch images.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Thumbnails are all about the same size, so instead of a malloc each they
+ * go to fixed size slots in slabs of SLAB_BYTES. A slot holds the JImage
+ * header and its pixels. create_image() uses a slot for images that fit the
+ * slot size set with slab_set_size() but need at least a quarter of it,
+ * anything else is one malloc for header and pixels together. Slabs whose
+ * slots are all free are given back, so memory use drops after a resize
+ * throws away the old thumbnails. On Linux slabs can be backed by
+ * transparent huge pages.
+ *
+ * Decodes that are scaled down and freed right away go to a scratch buffer
+ * kept by each thread, see create_scratch_image(). It grows to the largest
+ * decode seen, and is freed after SLAB_SCRATCH_SHRINK decodes in a row that
+ * needed under a quarter of it, or when the thread goes idle.
+ */
+
+#define SLAB_BYTES (4 << 20)
+#define SLAB_HUGE_PAGE (2 << 20)
+#define SLAB_SCRATCH_MAX (32 << 20) // bigger scratch images are malloc'd
+#define SLAB_SCRATCH_SHRINK 8
+
+typedef struct JSlab {
+    struct JSlab *next, *prev; // slabs of current size with free slots
+    size_t slotBytes;
+    int slots, used;
+    int fresh; // slots from here on were never handed out
+    void *freeSlots; // linked through first word of each free slot
+    int scratch, huge, partial; // partial: on the list above
+    int small; // scratch decodes in a row that needed under a quarter
+    size_t bytes;
+    unsigned char *memory;
+} JSlab;
+
+typedef struct {
+    int slabImages, mallocImages, scratchImages; // created each way
+    int slabs;
+    long long slabBytes, peakSlabBytes; // reserved for slabs
+    long long slotBytes; // in all slots handed out so far
+    long long imageBytes; // what images in those slots needed, rest is waste
+    long long scratchBytes, peakScratchBytes; // held in scratch buffers
+} JSlabStats;
+
+// Call before threads start, create_image() just mallocs until then
+void init_slabs(int hugePages);
+
+// Frees all slabs, images in them must be gone
+void quit_slabs(void);
+
+// Images up to w x h pixels get slab slots from now on. Existing slabs
+// of other sizes are freed as their images go.
+void slab_set_size(int w, int h);
+
+// NULL if size doesn't fit slabs or there's no memory, caller mallocs then
+JImage *slab_create_image(int w, int h);
+
+// Free image with img->slab set. Scratch images must be freed by the same
+// thread that made them.
+void slab_destroy_image(JImage *img);
+
+// Counts an image create_image() had to malloc
+void slab_count_malloc(void);
+
+// Image that will be destroyed before the calling thread makes another one,
+// e.g. a decode that is scaled down next. Uses the thread's scratch buffer
+// if it's free and big enough, otherwise same as create_image().
+JImage *create_scratch_image(int width, int height);
+
+// Frees calling thread's scratch buffer unless it's in use, e.g. when the
+// thread has nothing to do for a while. Cheap when there's none.
+void slab_release_scratch(void);
+
+void slab_stats(JSlabStats *stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
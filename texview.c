@@ -0,0 +1,157 @@
+/**
+ * Images as tiles of GPU textures, for panning without redrawing.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "texview.h"
+
+JTexView *create_texview(SDL_Renderer *renderer, const void *source,
+        int w, int h, int shift, int tileSize) {
+    JTexView *view = (JTexView *)calloc(1, sizeof(JTexView));
+
+    if(view == NULL)
+        return NULL;
+
+    view->renderer = renderer;
+    view->source = source;
+    view->w = w;
+    view->h = h;
+    view->shift = shift;
+    view->tileSize = tileSize;
+    view->cols = (w + tileSize - 1) / tileSize;
+    view->rows = (h + tileSize - 1) / tileSize;
+
+    if((view->tex = (SDL_Texture **)calloc(view->cols * view->rows, sizeof(SDL_Texture *))) == NULL) {
+        free(view);
+        return NULL;
+    }
+
+    return view;
+}
+
+void destroy_texview(JTexView *view) {
+    int i;
+
+    for(i = 0; i < view->cols * view->rows; i++)
+        if(view->tex[i] != NULL)
+            SDL_DestroyTexture(view->tex[i]);
+
+    free(view->tex);
+    free(view);
+}
+
+int texview_has(JTexView *view, int c, int r) {
+    return view->tex[r * view->cols + c] != NULL;
+}
+
+int texview_set(JTexView *view, int c, int r, JImage *img, int sx, int sy) {
+    SDL_Texture **tex = &view->tex[r * view->cols + c];
+    int w = MIN(view->tileSize, view->w - c * view->tileSize);
+    int h = MIN(view->tileSize, view->h - r * view->tileSize);
+
+    if(sx + w > img->w || sy + h > img->h)
+        return -1;
+
+    if(*tex == NULL) {
+        // Scaled up levels would look blocky with nearest neighbour
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, view->shift ? "linear" : "nearest");
+        if((*tex = SDL_CreateTexture(view->renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STATIC, w, h)) == NULL)
+            return -1;
+        view->count++;
+    }
+
+    return SDL_UpdateTexture(*tex, NULL, &GETPIXEL(img, sx, sy), img->w * sizeof(Uint32));
+}
+
+// Tile range at view's scale covering full size rectangle
+static void tileRange(JTexView *view, int x, int y, int w, int h,
+        int *c0, int *r0, int *c1, int *r1) {
+    *c0 = MAX((x >> view->shift) / view->tileSize, 0);
+    *r0 = MAX((y >> view->shift) / view->tileSize, 0);
+    *c1 = MIN(((x + w - 1) >> view->shift) / view->tileSize, view->cols - 1);
+    *r1 = MIN(((y + h - 1) >> view->shift) / view->tileSize, view->rows - 1);
+}
+
+void texview_upload(JTexView *view, JImage *img, int x, int y, int w, int h) {
+    int c, r, c0, r0, c1, r1;
+
+    tileRange(view, x, y, w, h, &c0, &r0, &c1, &r1);
+
+    for(r = r0; r <= r1; r++)
+        for(c = c0; c <= c1; c++)
+            if(!texview_has(view, c, r))
+                texview_set(view, c, r, img, c * view->tileSize, r * view->tileSize);
+}
+
+int texview_render(JTexView *view, int x, int y, int w, int h, int dx, int dy) {
+    SDL_Rect clip, dest;
+    SDL_Texture *tex;
+    int c, r, c0, r0, c1, r1, missing = 0, size = view->tileSize << view->shift;
+
+    tileRange(view, x, y, w, h, &c0, &r0, &c1, &r1);
+
+    // Scaled up edge tiles can reach past the image, keep them in view
+    clip.x = dx;
+    clip.y = dy;
+    clip.w = w;
+    clip.h = h;
+    SDL_RenderSetClipRect(view->renderer, &clip);
+
+    for(r = r0; r <= r1; r++) {
+        for(c = c0; c <= c1; c++) {
+            if((tex = view->tex[r * view->cols + c]) == NULL) {
+                missing++;
+                continue;
+            }
+            dest.x = dx + c * size - x;
+            dest.y = dy + r * size - y;
+            dest.w = MIN(view->tileSize, view->w - c * view->tileSize) << view->shift;
+            dest.h = MIN(view->tileSize, view->h - r * view->tileSize) << view->shift;
+            SDL_RenderCopy(view->renderer, tex, NULL, &dest);
+        }
+    }
+
+    SDL_RenderSetClipRect(view->renderer, NULL);
+
+    return missing;
+}
+
+void texview_trim(JTexView *view, int x, int y, int w, int h, int max) {
+    int c, r, c0, r0, c1, r1;
+
+    if(view->count <= max)
+        return;
+
+    tileRange(view, x, y, w, h, &c0, &r0, &c1, &r1);
+
+    for(r = 0; r < view->rows; r++) {
+        for(c = 0; c < view->cols; c++) {
+            if(view->tex[r * view->cols + c] == NULL ||
+                    (c >= c0 - 1 && c <= c1 + 1 && r >= r0 - 1 && r <= r1 + 1))
+                continue; // keep a ring around the view for small moves
+            SDL_DestroyTexture(view->tex[r * view->cols + c]);
+            view->tex[r * view->cols + c] = NULL;
+            view->count--;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * Images as tiles of GPU textures, for panning without redrawing.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __TEXVIEW_H
+#define __TEXVIEW_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * An image uploaded to the renderer as a grid of textures, so that panning
+ * is just different SDL_RenderCopy() rectangles. Tiles are uploaded when
+ * they first come into view and kept until the view is destroyed or
+ * trimmed. A view can be for a scaled down version of the image (shift),
+ * the GPU scales it back up when rendering.
+ */
+
+#define TEXVIEW_TILE 512
+
+typedef struct {
+    SDL_Renderer *renderer;
+    const void *source; // caller's key for what's uploaded
+    int w, h; // size in own pixels
+    int shift; // rendered 1 << shift times bigger
+    int tileSize, cols, rows;
+    SDL_Texture **tex; // NULL for tiles not uploaded yet
+    int count; // textures alive
+} JTexView;
+
+JTexView *create_texview(SDL_Renderer *renderer, const void *source,
+        int w, int h, int shift, int tileSize);
+
+void destroy_texview(JTexView *view);
+
+// Tile at column c, row r has been uploaded
+int texview_has(JTexView *view, int c, int r);
+
+// Upload tile c, r from img, which has the tile's pixels at sx, sy
+int texview_set(JTexView *view, int c, int r, JImage *img, int sx, int sy);
+
+// Upload missing tiles in view (x, y, w, h in full size pixels) from img,
+// which is the whole image at view's scale
+void texview_upload(JTexView *view, JImage *img, int x, int y, int w, int h);
+
+// Render what's uploaded of the view at screen position dx, dy, returns
+// the number of tiles in view that are still missing
+int texview_render(JTexView *view, int x, int y, int w, int h, int dx, int dy);
+
+// Drop textures outside view if there are more than max of them
+void texview_trim(JTexView *view, int x, int y, int w, int h, int max);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
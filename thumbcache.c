@@ -0,0 +1,580 @@
+/**
+ * Persistent on-disk thumbnail cache.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#if defined _WIN32 || defined _WIN64
+#include "windows.h"
+
+#define HAVE_BOOLEAN /* Fix jpeglib */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#if defined _WIN32 || defined _WIN64
+#include <direct.h>
+#define MKDIR(path) _mkdir(path)
+#else
+#include <sys/mman.h>
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
+#include <jpeglib.h>
+
+#if defined _WIN32 || defined _WIN64
+#undef HAVE_STDDEF_H /* Fix SDL warning */
+#endif
+
+#include "thumbcache.h"
+
+#define THUMBCACHE_QUALITY 90
+
+// Find (and create) cache directory, returns zero on failure
+static int cacheDir(char *dir, size_t len) {
+    const char *base;
+
+    if((base = getenv("XDG_CACHE_HOME")) != NULL && *base) {
+        snprintf(dir, len, "%s", base);
+#if defined _WIN32 || defined _WIN64
+    } else if((base = getenv("LOCALAPPDATA")) != NULL && *base) {
+        snprintf(dir, len, "%s", base);
+#endif
+    } else if((base = getenv("HOME")) != NULL && *base) {
+        snprintf(dir, len, "%s/.cache", base);
+        MKDIR(dir);
+    } else
+        return 0;
+
+    if(strlen(dir) + 10 >= len)
+        return 0;
+
+    strcat(dir, "/jzipview");
+    MKDIR(dir); // fails harmlessly if it exists
+
+    return 1;
+}
+
+// 64-bit FNV-1a, good enough to name cache files
+static Uint64 hashString(const char *s) {
+    Uint64 hash = 14695981039346656037ULL;
+
+    for(; *s; s++)
+        hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+
+    return hash;
+}
+
+static int compareKey(const JThumbCacheEntry *a, Uint64 offset, int w, int h) {
+    if(a->offset != offset)
+        return a->offset < offset ? -1 : 1;
+    if(a->cellW != w)
+        return a->cellW < w ? -1 : 1;
+    if(a->cellH != h)
+        return a->cellH < h ? -1 : 1;
+    return 0;
+}
+
+static int compareEntries(const void *a, const void *b) {
+    const JThumbCacheEntry *eb = &((const JThumbCacheItem *)b)->entry;
+    return compareKey(&((const JThumbCacheItem *)a)->entry, eb->offset, eb->cellW, eb->cellH);
+}
+
+static int compareRecent(const void *a, const void *b) {
+    Uint32 ua = ((const JThumbCacheItem *)a)->entry.lastUsed, ub = ((const JThumbCacheItem *)b)->entry.lastUsed;
+    return (ua < ub) - (ua > ub); // newest first
+}
+
+static void unmapFile(JThumbCache *cache) {
+    if(cache->map == NULL)
+        return;
+#if defined _WIN32 || defined _WIN64
+    free(cache->map);
+#else
+    munmap(cache->map, cache->mapSize);
+#endif
+    cache->map = NULL;
+    cache->entries = NULL;
+    cache->count = 0;
+}
+
+// Map existing cache file, ignoring it if it's for a different archive
+static void mapFile(JThumbCache *cache) {
+    JThumbCacheHeader *header;
+    struct stat st;
+    FILE *fp;
+    Uint32 i;
+
+    if((fp = fopen(cache->path, "rb")) == NULL)
+        return;
+
+    if(fstat(fileno(fp), &st) || st.st_size < (long)sizeof(JThumbCacheHeader)) {
+        fclose(fp);
+        return;
+    }
+
+    cache->mapSize = st.st_size;
+#if defined _WIN32 || defined _WIN64
+    if((cache->map = (unsigned char *)malloc(cache->mapSize)) != NULL &&
+            fread(cache->map, 1, cache->mapSize, fp) != cache->mapSize) {
+        free(cache->map);
+        cache->map = NULL;
+    }
+#else
+    cache->map = (unsigned char *)mmap(NULL, cache->mapSize, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if(cache->map == MAP_FAILED)
+        cache->map = NULL;
+#endif
+    fclose(fp);
+
+    if(cache->map == NULL)
+        return;
+
+    header = (JThumbCacheHeader *)cache->map;
+
+    if(memcmp(header->magic, THUMBCACHE_MAGIC, 4) || header->version != THUMBCACHE_VERSION ||
+            header->archiveSize != cache->archiveSize || header->archiveTime != cache->archiveTime ||
+            sizeof(JThumbCacheHeader) + (Uint64)header->count * sizeof(JThumbCacheEntry) > cache->mapSize) {
+        unmapFile(cache); // stale, will be overwritten on close
+        return;
+    }
+
+    cache->entries = (JThumbCacheEntry *)(cache->map + sizeof(JThumbCacheHeader));
+    cache->count = header->count;
+
+    for(i = 0; i < header->count; i++) {
+        if(cache->entries[i].dataOffset + cache->entries[i].dataSize > cache->mapSize) {
+            unmapFile(cache); // truncated file
+            return;
+        }
+    }
+}
+
+int thumbcache_file(const char *archive, const char *extension, char *path, size_t len) {
+    char dir[900], full[1024];
+
+    if(!cacheDir(dir, sizeof(dir)))
+        return 0;
+
+#if defined _WIN32 || defined _WIN64
+    if(_fullpath(full, archive, sizeof(full)) == NULL)
+#else
+    if(realpath(archive, full) == NULL)
+#endif
+        return 0;
+
+    snprintf(path, len, "%s/%016llx%s", dir, (unsigned long long)hashString(full), extension);
+
+    return 1;
+}
+
+JThumbCache *create_thumbcache(const char *archive, long long limit) {
+    JThumbCache *cache;
+    struct stat st;
+
+    if(limit <= 0 || stat(archive, &st))
+        return NULL;
+
+    if((cache = (JThumbCache *)calloc(1, sizeof(JThumbCache))) == NULL)
+        return NULL;
+
+    if(!thumbcache_file(archive, ".jzc", cache->path, sizeof(cache->path))) {
+        free(cache);
+        return NULL;
+    }
+    cache->archiveSize = st.st_size;
+    cache->archiveTime = st.st_mtime;
+    cache->limit = limit;
+
+    if((cache->lock = SDL_CreateMutex()) == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    mapFile(cache);
+
+    if(cache->count && (cache->used = (Uint32 *)calloc(cache->count, sizeof(Uint32))) == NULL)
+        unmapFile(cache);
+
+    return cache;
+}
+
+// Per-encode error state, like in loader.c
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} ThumbErrorMgr;
+
+static void error_exit(j_common_ptr cinfo) {
+    longjmp(((ThumbErrorMgr *)cinfo->err)->setjmp_buffer, 1);
+}
+
+// Compress thumbnail to a malloc'd JPEG, returns NULL on errors
+static unsigned char *encodeThumb(JImage *thumb, unsigned long *size) {
+    struct jpeg_compress_struct cinfo;
+    ThumbErrorMgr jerr;
+    unsigned char * volatile out = NULL, *row;
+    unsigned long outSize = 0;
+    int x;
+
+    if((row = (unsigned char *)malloc(thumb->w * 3)) == NULL)
+        return NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit;
+
+    if(setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(row);
+        free(out);
+        return NULL;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, (unsigned char **)&out, &outSize);
+
+    cinfo.image_width = thumb->w;
+    cinfo.image_height = thumb->h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, THUMBCACHE_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while(cinfo.next_scanline < cinfo.image_height) {
+        Uint32 *src = thumb->data + cinfo.next_scanline * thumb->w;
+        for(x = 0; x < thumb->w; x++) {
+            row[x*3+0] = GETR(src[x]);
+            row[x*3+1] = GETG(src[x]);
+            row[x*3+2] = GETB(src[x]);
+        }
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+
+    *size = outSize;
+    return out;
+}
+
+static int validEntry(JThumbCacheEntry *e, JPEGRecord *jpeg) {
+    return e->crc == jpeg->crc && e->compressedSize == (Uint32)jpeg->compressedSize;
+}
+
+// Slot of key in the added table, or the empty one where it would go.
+// Call with lock held and a table to look in.
+static int addedSlot(JThumbCache *cache, Uint64 offset, int w, int h) {
+    Uint64 hash = (offset ^ (Uint64)w << 40 ^ (Uint64)h << 52) * 0x9E3779B97F4A7C15ULL;
+    int slot = (int)(hash >> 32) & cache->addedMask, i;
+
+    for(; (i = cache->addedSlots[slot]) != 0; slot = (slot + 1) & cache->addedMask)
+        if(!compareKey(&cache->added[i - 1].entry, offset, w, h))
+            break;
+
+    return slot;
+}
+
+// Doubles the added table, keeping it at most half full. Call with lock held.
+static int growSlots(JThumbCache *cache) {
+    int size = cache->addedSlots ? (cache->addedMask + 1) * 2 : 512, *slots, i;
+    JThumbCacheEntry *e;
+
+    if((slots = (int *)calloc(size, sizeof(int))) == NULL)
+        return 0;
+
+    free(cache->addedSlots);
+    cache->addedSlots = slots;
+    cache->addedMask = size - 1;
+
+    for(i = 0; i < cache->addedCount; i++) {
+        e = &cache->added[i].entry;
+        slots[addedSlot(cache, e->offset, e->cellW, e->cellH)] = i + 1;
+    }
+
+    return 1;
+}
+
+JImage *thumbcache_get(JThumbCache *cache, JPEGRecord *jpeg, int w, int h) {
+    JThumbCacheEntry *e = NULL;
+    unsigned char *data = NULL;
+    int lo = 0, hi = cache->count - 1, mid, c, i;
+    Uint32 size = 0;
+
+    while(lo <= hi) { // mapped entries are sorted by key
+        mid = (lo + hi) / 2;
+        c = compareKey(&cache->entries[mid], jpeg->offset, w, h);
+        if(!c) {
+            e = &cache->entries[mid];
+            break;
+        }
+        if(c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    SDL_LockMutex(cache->lock);
+    if(e != NULL && validEntry(e, jpeg)) {
+        data = cache->map + e->dataOffset;
+        size = e->dataSize;
+        cache->used[e - cache->entries] = (Uint32)time(NULL);
+    } else if(cache->addedSlots != NULL && // maybe made earlier this session
+            (i = cache->addedSlots[addedSlot(cache, jpeg->offset, w, h)]) != 0 &&
+            validEntry(e = &cache->added[i - 1].entry, jpeg)) {
+        data = cache->added[i - 1].data;
+        size = e->dataSize;
+    }
+
+    if(data == NULL)
+        cache->misses++;
+    else
+        cache->hits++;
+    SDL_UnlockMutex(cache->lock);
+
+    // Thumbnail data is never freed before the cache, so no lock needed here
+    return data ? read_JPEG_custom(data, size, 0, 0) : NULL;
+}
+
+void thumbcache_put(JThumbCache *cache, JPEGRecord *jpeg, int w, int h, JImage *thumb) {
+    JThumbCacheItem *item;
+    unsigned char *data;
+    unsigned long size;
+    int slot = 0, i = 0;
+
+    if((data = encodeThumb(thumb, &size)) == NULL)
+        return;
+
+    SDL_LockMutex(cache->lock);
+    if(cache->addedSlots != NULL)
+        i = cache->addedSlots[slot = addedSlot(cache, jpeg->offset, w, h)];
+
+    if(i && validEntry(&cache->added[i - 1].entry, jpeg)) { // another worker was faster
+        cache->added[i - 1].entry.lastUsed = (Uint32)time(NULL);
+        SDL_UnlockMutex(cache->lock);
+        free(data);
+        return;
+    }
+
+    if(i) // stale, thumbcache_get() never hands those out so it's not in use
+        free(cache->added[i - 1].data);
+    else {
+        if(cache->addedCount == cache->addedMax) {
+            int max = cache->addedMax ? cache->addedMax * 2 : 256;
+            JThumbCacheItem *added = (JThumbCacheItem *)realloc(cache->added, max * sizeof(JThumbCacheItem));
+
+            if(added == NULL) {
+                SDL_UnlockMutex(cache->lock);
+                free(data);
+                return;
+            }
+
+            cache->added = added;
+            cache->addedMax = max;
+        }
+
+        if(cache->addedSlots == NULL || (cache->addedCount + 1) * 2 > cache->addedMask + 1) {
+            if(!growSlots(cache)) {
+                SDL_UnlockMutex(cache->lock);
+                free(data);
+                return;
+            }
+            slot = addedSlot(cache, jpeg->offset, w, h);
+        }
+
+        i = ++cache->addedCount;
+        cache->addedSlots[slot] = i;
+    }
+
+    item = &cache->added[i - 1];
+    memset(item, 0, sizeof(JThumbCacheItem));
+    item->entry.offset = jpeg->offset;
+    item->entry.crc = jpeg->crc;
+    item->entry.compressedSize = jpeg->compressedSize;
+    item->entry.cellW = w;
+    item->entry.cellH = h;
+    item->entry.lastUsed = (Uint32)time(NULL);
+    item->entry.dataSize = size;
+    item->data = data;
+    SDL_UnlockMutex(cache->lock);
+}
+
+typedef struct {
+    char name[256];
+    time_t time;
+    long long size;
+} JCacheFile;
+
+static int compareTime(const void *a, const void *b) {
+    time_t ta = ((const JCacheFile *)a)->time, tb = ((const JCacheFile *)b)->time;
+    return (ta > tb) - (ta < tb); // oldest first
+}
+
+// Delete least recently written cache files until directory fits the limit
+static void evictFiles(JThumbCache *cache) {
+    char dir[1024], path[2048];
+    JCacheFile *files = NULL;
+    int count = 0, max = 0, i;
+    long long total = 0;
+    struct dirent *de;
+    struct stat st;
+    char *slash;
+    DIR *d;
+
+    strcpy(dir, cache->path);
+    if((slash = strrchr(dir, '/')) == NULL)
+        return;
+    *slash = '\0';
+
+    if((d = opendir(dir)) == NULL)
+        return;
+
+    while((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+
+        if(len < 4 || len >= 256 || (strcmp(de->d_name + len - 4, ".jzc") &&
+                    strcmp(de->d_name + len - 4, ".jzi"))) // index files from zipindex.c
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if(stat(path, &st))
+            continue;
+
+        if(count == max) {
+            void *grown = realloc(files, (max = max ? max * 2 : 64) * sizeof(*files));
+            if(grown == NULL)
+                break;
+            files = grown;
+        }
+
+        strcpy(files[count].name, de->d_name);
+        files[count].time = st.st_mtime;
+        files[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+    closedir(d);
+
+    qsort(files, count, sizeof(JCacheFile), compareTime); // two files per archive
+
+    for(i = 0; i < count && total > cache->limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+        if(!strcmp(path, cache->path))
+            continue; // the one we just wrote
+        if(!remove(path))
+            total -= files[i].size;
+    }
+
+    free(files);
+}
+
+// Write kept entries to a new file, most recently used first until limit
+static void writeFile(JThumbCache *cache) {
+    JThumbCacheHeader header;
+    JThumbCacheItem *items;
+    long long total = sizeof(JThumbCacheHeader);
+    char tmpPath[1100];
+    Uint64 offset;
+    int count = 0, kept, i;
+    FILE *fp;
+
+    if((items = (JThumbCacheItem *)malloc((cache->count + cache->addedCount + 1) * sizeof(JThumbCacheItem))) == NULL)
+        return;
+
+    for(i = 0; i < cache->count; i++) {
+        items[count].entry = cache->entries[i];
+        if(cache->used[i])
+            items[count].entry.lastUsed = cache->used[i];
+        items[count++].data = cache->map + cache->entries[i].dataOffset;
+    }
+    memcpy(items + count, cache->added, cache->addedCount * sizeof(JThumbCacheItem));
+    count += cache->addedCount;
+
+    qsort(items, count, sizeof(JThumbCacheItem), compareRecent);
+    for(kept = 0; kept < count; kept++) {
+        total += sizeof(JThumbCacheEntry) + items[kept].entry.dataSize;
+        if(total > cache->limit)
+            break;
+    }
+    qsort(items, kept, sizeof(JThumbCacheItem), compareEntries);
+
+    offset = sizeof(JThumbCacheHeader) + (Uint64)kept * sizeof(JThumbCacheEntry);
+    for(i = 0; i < kept; i++) {
+        items[i].entry.dataOffset = offset;
+        offset += items[i].entry.dataSize;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, THUMBCACHE_MAGIC, 4);
+    header.version = THUMBCACHE_VERSION;
+    header.archiveSize = cache->archiveSize;
+    header.archiveTime = cache->archiveTime;
+    header.count = kept;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cache->path);
+    if((fp = fopen(tmpPath, "wb")) == NULL) {
+        free(items);
+        return;
+    }
+
+    fwrite(&header, sizeof(header), 1, fp);
+    for(i = 0; i < kept; i++)
+        fwrite(&items[i].entry, sizeof(JThumbCacheEntry), 1, fp);
+    for(i = 0; i < kept; i++)
+        fwrite(items[i].data, 1, items[i].entry.dataSize, fp);
+
+    if(ferror(fp) | fclose(fp)) {
+        remove(tmpPath);
+        free(items);
+        return;
+    }
+
+    free(items);
+    unmapFile(cache); // data came from there, so only now
+    remove(cache->path); // rename() won't replace on Windows
+    rename(tmpPath, cache->path);
+}
+
+void destroy_thumbcache(JThumbCache *cache) {
+    int i;
+
+    if(cache->addedCount) {
+        writeFile(cache);
+        evictFiles(cache);
+    } else if(cache->hits)
+        utime(cache->path, NULL); // keep recently used files from eviction
+
+    unmapFile(cache);
+
+    for(i = 0; i < cache->addedCount; i++)
+        free(cache->added[i].data);
+
+    free(cache->added);
+    free(cache->addedSlots);
+    free(cache->used);
+    SDL_DestroyMutex(cache->lock);
+    free(cache);
+}
@@ -0,0 +1,112 @@
+/**
+ * Persistent on-disk thumbnail cache.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __THUMBCACHE_H
+#define __THUMBCACHE_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+#include "loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * One cache file per archive under $XDG_CACHE_HOME/jzipview (or
+ * ~/.cache/jzipview), named by a hash of the archive path. Layout is
+ * header + entry table sorted by key + JPEG compressed thumbnails, so the
+ * file can be mapped and used as is. Thumbnails made during the session
+ * are kept in memory, found by a hash of the same key, and the file is
+ * rewritten on close.
+ */
+
+#define THUMBCACHE_MAGIC "JZTC"
+#define THUMBCACHE_VERSION 2 // 2: thumbnails follow EXIF orientation
+
+typedef struct {
+    char magic[4];
+    Uint32 version;
+    Uint64 archiveSize; // archive changes invalidate the whole file
+    Sint64 archiveTime;
+    Uint32 count;
+    Uint32 reserved;
+} JThumbCacheHeader;
+
+typedef struct {
+    Uint64 offset; // local header offset in archive
+    Uint32 crc;
+    Uint32 compressedSize;
+    Uint16 cellW, cellH; // requested thumbnail size
+    Uint32 lastUsed; // unix time, for eviction
+    Uint64 dataOffset; // JPEG data position in cache file
+    Uint32 dataSize;
+    Uint32 reserved;
+} JThumbCacheEntry;
+
+typedef struct {
+    JThumbCacheEntry entry;
+    unsigned char *data;
+} JThumbCacheItem;
+
+typedef struct {
+    char path[1024];
+    Uint64 archiveSize;
+    Sint64 archiveTime;
+    long long limit; // bytes, for this file and whole cache directory
+
+    unsigned char *map; // existing cache file
+    size_t mapSize;
+    JThumbCacheEntry *entries; // inside map
+    int count;
+    Uint32 *used; // when mapped entries were hit this session
+
+    JThumbCacheItem *added; // thumbnails made this session
+    int addedCount, addedMax;
+    int *addedSlots; // hash table of added index + 1 by key, 0 for empty
+    int addedMask; // table size - 1
+
+    SDL_mutex *lock;
+    int hits, misses;
+} JThumbCache;
+
+// Path of archive's cache file with given extension in the cache directory,
+// returns zero if there is no cache directory
+int thumbcache_file(const char *archive, const char *extension, char *path, size_t len);
+
+// Returns NULL if the cache can't be used (no cache dir, archive missing)
+JThumbCache *create_thumbcache(const char *archive, long long limit);
+
+// Writes new thumbnails to disk, evicts old ones and frees the cache
+void destroy_thumbcache(JThumbCache *cache);
+
+// Thread safe, returns NULL on miss
+JImage *thumbcache_get(JThumbCache *cache, JPEGRecord *jpeg, int w, int h);
+
+// Thread safe, stores a copy of the thumbnail
+void thumbcache_put(JThumbCache *cache, JPEGRecord *jpeg, int w, int h, JImage *thumb);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
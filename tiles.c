@@ -0,0 +1,275 @@
+/**
+ * Tiled on-demand decoding of huge images for fullsize mode.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tiles.h"
+
+// Level scales as powers of two, last one is the whole 1/8 preview
+static const int levelShift[TILE_LEVELS] = { 0, 2, 3 };
+
+static int nextId = 1; // only used from main thread
+
+JTiledImage *create_tiled(JPool *pool, JMemCache *cache, JPEGRecord *jpeg,
+        int index, JImage *preview, int w, int h) {
+    JTiledImage *tiled = (JTiledImage *)calloc(1, sizeof(JTiledImage));
+    int L, s;
+
+    if(tiled == NULL)
+        return NULL;
+
+    tiled->pool = pool;
+    tiled->cache = cache;
+    tiled->jpeg = jpeg;
+    tiled->index = index;
+    tiled->id = nextId++;
+    tiled->lastX0 = -1;
+
+    for(L = 0; L < TILE_LEVELS - 1; L++) {
+        s = levelShift[L];
+        tiled->w[L] = (w + (1 << s) - 1) >> s; // same rounding as libjpeg
+        tiled->h[L] = (h + (1 << s) - 1) >> s;
+        tiled->cols[L] = (tiled->w[L] + TILE_SIZE - 1) / TILE_SIZE;
+        tiled->rows[L] = (tiled->h[L] + TILE_SIZE - 1) / TILE_SIZE;
+        tiled->tiles[L] = (JTile *)calloc(tiled->cols[L] * tiled->rows[L], sizeof(JTile));
+        if(tiled->tiles[L] == NULL) {
+            destroy_tiled(tiled);
+            return NULL;
+        }
+    }
+
+    tiled->w[L] = preview->w;
+    tiled->h[L] = preview->h;
+    tiled->cols[L] = tiled->rows[L] = 1;
+
+    if((tiled->coarsest = create_image(preview->w, preview->h)) == NULL) {
+        destroy_tiled(tiled);
+        return NULL;
+    }
+    copy_image(tiled->coarsest, preview);
+
+    return tiled;
+}
+
+// Level of a job from its scale
+static int jobLevel(JLoadJob *job) {
+    int L;
+
+    for(L = 0; L < TILE_LEVELS - 1 && levelShift[L] != job->level; L++)
+        ;
+
+    return L;
+}
+
+// Jobs decode a row of adjacent tiles, each tile row needs an entropy
+// decoding pass from the top of the image, so these are much cheaper
+static void markTiles(JTiledImage *tiled, JLoadJob *job, int queued) {
+    int L = jobLevel(job), i;
+    JTile *tile = &tiled->tiles[L][(job->y / TILE_SIZE) * tiled->cols[L] + job->x / TILE_SIZE];
+
+    for(i = 0; i < (job->w + TILE_SIZE - 1) / TILE_SIZE; i++)
+        tile[i].queued = queued;
+}
+
+static void cancelQueued(JTiledImage *tiled) {
+    JLoadJob *job, *list = pool_cancel(tiled->pool, MEMCACHE_TILE);
+
+    for(job = list; job != NULL; job = job->next)
+        if(job->generation == tiled->id)
+            markTiles(tiled, job, 0);
+
+    destroy_jobs(list);
+}
+
+void destroy_tiled(JTiledImage *tiled) {
+    int L, i;
+
+    cancelQueued(tiled); // ones already running are ignored by tiled_collect
+
+    for(L = 0; L < TILE_LEVELS - 1; L++) {
+        if(tiled->tiles[L] == NULL)
+            continue;
+        // Keys are tile addresses, so they must go before the memory does
+        for(i = 0; i < tiled->cols[L] * tiled->rows[L]; i++)
+            memcache_remove(tiled->cache, &tiled->tiles[L][i], MEMCACHE_TILE);
+        free(tiled->tiles[L]);
+    }
+
+    for(L = 0; L < TILE_LEVELS; L++)
+        if(tiled->views[L] != NULL)
+            destroy_texview(tiled->views[L]);
+
+    if(tiled->coarsest != NULL)
+        destroy_image(tiled->coarsest);
+    free(tiled);
+}
+
+static int tileNeeded(JTiledImage *tiled, int L, int c, int r) {
+    JTile *tile;
+
+    if(c < 0 || r < 0 || c >= tiled->cols[L] || r >= tiled->rows[L])
+        return 0;
+
+    tile = &tiled->tiles[L][r * tiled->cols[L] + c];
+    return !tile->queued && !tile->failed && !memcache_contains(tiled->cache, tile, MEMCACHE_TILE);
+}
+
+// Queue tiles c0..c1 on row r that are missing, a job per adjacent run
+static void submitTiles(JTiledImage *tiled, int L, int c0, int c1, int r) {
+    JLoadJob *job;
+    int c;
+
+    for(; c0 <= c1; c0 = c + 1) {
+        while(c0 <= c1 && !tileNeeded(tiled, L, c0, r))
+            c0++;
+        for(c = c0; c <= c1 && tileNeeded(tiled, L, c, r); c++)
+            ;
+        if(c0 > c1 || (job = (JLoadJob *)calloc(1, sizeof(JLoadJob))) == NULL)
+            return;
+
+        job->index = tiled->index;
+        job->jpeg = tiled->jpeg;
+        job->kind = MEMCACHE_TILE;
+        job->level = levelShift[L];
+        job->x = c0 * TILE_SIZE;
+        job->y = r * TILE_SIZE;
+        job->w = MIN(c * TILE_SIZE, tiled->w[L]) - job->x;
+        job->h = MIN(TILE_SIZE, tiled->h[L] - job->y);
+        job->generation = tiled->id;
+
+        pool_submit_job(tiled->pool, job);
+        markTiles(tiled, job, 1);
+    }
+}
+
+void tiled_request(JTiledImage *tiled, int x, int y, int w, int h) {
+    int x0 = x / TILE_SIZE, y0 = y / TILE_SIZE;
+    int x1 = (x + w - 1) / TILE_SIZE, y1 = (y + h - 1) / TILE_SIZE;
+    int L = TILE_LEVELS - 2, s = levelShift[L], r;
+
+    if(x0 == tiled->lastX0 && y0 == tiled->lastY0 && x1 == tiled->lastX1 && y1 == tiled->lastY1)
+        return; // same tiles as before, queue is in right order already
+
+    cancelQueued(tiled); // drop what's not in view anymore, requeue the rest
+
+    // Coarse tiles first, they are 16 times cheaper and stand in for the rest
+    for(r = (y >> s) / TILE_SIZE; r <= ((y + h - 1) >> s) / TILE_SIZE; r++)
+        submitTiles(tiled, L, (x >> s) / TILE_SIZE, ((x + w - 1) >> s) / TILE_SIZE, r);
+
+    for(r = y0; r <= y1; r++)
+        submitTiles(tiled, 0, x0, x1, r);
+
+    // Ring around the view, in case mouse moves there next
+    submitTiles(tiled, 0, x0 - 1, x1 + 1, y0 - 1);
+    submitTiles(tiled, 0, x0 - 1, x1 + 1, y1 + 1);
+    for(r = y0; r <= y1; r++) {
+        submitTiles(tiled, 0, x0 - 1, x0 - 1, r);
+        submitTiles(tiled, 0, x1 + 1, x1 + 1, r);
+    }
+
+    tiled->lastX0 = x0;
+    tiled->lastY0 = y0;
+    tiled->lastX1 = x1;
+    tiled->lastY1 = y1;
+}
+
+int tiled_collect(JTiledImage *tiled, JLoadJob *job) {
+    JMemCacheItem *item;
+    JImage *part;
+    JTile *tile;
+    int L, i, x;
+
+    if(job->generation != tiled->id)
+        return 0; // from an image destroyed before
+
+    markTiles(tiled, job, 0);
+
+    L = jobLevel(job);
+    tile = &tiled->tiles[L][(job->y / TILE_SIZE) * tiled->cols[L] + job->x / TILE_SIZE];
+
+    for(i = 0, x = 0; x < job->w; i++, x += TILE_SIZE) { // split into tiles
+        if(job->image == NULL || (part = create_image(MIN(TILE_SIZE, job->w - x), job->h)) == NULL) {
+            tile[i].failed = 1;
+            continue;
+        }
+        blit_image(part, 0, 0, job->image, x, 0, part->w, part->h);
+        if((item = memcache_put_image(tiled->cache, &tile[i], MEMCACHE_TILE, part)) != NULL)
+            memcache_release(tiled->cache, item);
+        else
+            destroy_image(part);
+    }
+
+    return 1;
+}
+
+// Upload cached tiles of level L in view, returns how many are missing
+static int uploadTiles(JTiledImage *tiled, int L, int x, int y, int w, int h) {
+    JTexView *view = tiled->views[L];
+    JMemCacheItem *item;
+    int s = levelShift[L], c, r, missing = 0;
+
+    for(r = (y >> s) / TILE_SIZE; r <= MIN(((y + h - 1) >> s) / TILE_SIZE, tiled->rows[L] - 1); r++) {
+        for(c = (x >> s) / TILE_SIZE; c <= MIN(((x + w - 1) >> s) / TILE_SIZE, tiled->cols[L] - 1); c++) {
+            if(texview_has(view, c, r))
+                continue;
+            if((item = memcache_get(tiled->cache, &tiled->tiles[L][r * tiled->cols[L] + c],
+                            MEMCACHE_TILE)) != NULL) {
+                texview_set(view, c, r, (JImage *)item->object, 0, 0);
+                memcache_release(tiled->cache, item);
+                continue;
+            }
+            if(L == 0)
+                submitTiles(tiled, 0, c, c, r); // evicted since last request maybe
+            missing++;
+        }
+    }
+
+    return missing;
+}
+
+void tiled_render(JTiledImage *tiled, SDL_Renderer *renderer, int xoff, int yoff, int sw, int sh) {
+    int vw = MIN(sw, tiled->w[0]), vh = MIN(sh, tiled->h[0]);
+    int dx = (sw - vw) / 2, dy = (sh - vh) / 2; // center if fits
+    int L, keep = 2 * (vw / TILE_SIZE + 3) * (vh / TILE_SIZE + 3); // two screens worth
+
+    for(L = 0; L < TILE_LEVELS; L++)
+        if(tiled->views[L] == NULL && (tiled->views[L] = create_texview(renderer, tiled,
+                        tiled->w[L], tiled->h[L], levelShift[L],
+                        (L == TILE_LEVELS - 1) ? TEXVIEW_TILE : TILE_SIZE)) == NULL)
+            return;
+
+    // Gaps in full size tiles show coarser levels from under them
+    if(uploadTiles(tiled, 0, xoff, yoff, vw, vh)) {
+        for(L = TILE_LEVELS - 1; L > 0; L--) {
+            if(L == TILE_LEVELS - 1)
+                texview_upload(tiled->views[L], tiled->coarsest, xoff, yoff, vw, vh);
+            else
+                uploadTiles(tiled, L, xoff, yoff, vw, vh);
+            texview_render(tiled->views[L], xoff, yoff, vw, vh, dx, dy);
+        }
+    }
+
+    texview_render(tiled->views[0], xoff, yoff, vw, vh, dx, dy);
+
+    for(L = 0; L < TILE_LEVELS - 1; L++)
+        texview_trim(tiled->views[L], xoff, yoff, vw, vh, keep);
+}
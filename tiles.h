@@ -0,0 +1,90 @@
+/**
+ * Tiled on-demand decoding of huge images for fullsize mode.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __TILES_H
+#define __TILES_H
+
+#include "SDL2/SDL.h"
+
+#include "image.h"
+#include "loader.h"
+#include "memcache.h"
+#include "pool.h"
+#include "texview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Instead of one huge JImage, the image is a pyramid of DCT scaled levels
+ * 1/1, 1/4 and 1/8. The 1/8 level is the preview, decoded whole. The
+ * others are split into TILE_SIZE tiles that the pool decodes on demand
+ * with loadRegionFromZip(). Tiles live in the memory cache as
+ * MEMCACHE_TILE, keyed by their JTile. On screen each level is a JTexView
+ * and missing tiles show the coarser levels drawn under them, so something
+ * is always on screen.
+ */
+
+#define TILE_SIZE 256
+#define TILE_LEVELS 3 // scales in tiles.c
+
+typedef struct {
+    char queued, failed;
+} JTile;
+
+typedef struct {
+    JPool *pool;
+    JMemCache *cache;
+    JPEGRecord *jpeg;
+    int index; // entry index, caller's business
+    int id; // pool jobs carry this as generation
+
+    int w[TILE_LEVELS], h[TILE_LEVELS]; // level sizes
+    int cols[TILE_LEVELS], rows[TILE_LEVELS];
+    JTile *tiles[TILE_LEVELS]; // NULL for the last level
+    JImage *coarsest; // last level, whole
+    JTexView *views[TILE_LEVELS]; // uploaded tiles, created on first render
+
+    int lastX0, lastY0, lastX1, lastY1; // tile range of last request
+} JTiledImage;
+
+// Makes a copy of preview for the 1/8 level, w and h are full size
+JTiledImage *create_tiled(JPool *pool, JMemCache *cache, JPEGRecord *jpeg,
+        int index, JImage *preview, int w, int h);
+
+// Cancels queued tile loads and drops tiles from cache
+void destroy_tiled(JTiledImage *tiled);
+
+// Queue tiles to cover view (full size pixels) and a ring around it
+void tiled_request(JTiledImage *tiled, int x, int y, int w, int h);
+
+// Hand over a completed MEMCACHE_TILE job, returns 1 if it was ours
+int tiled_collect(JTiledImage *tiled, JLoadJob *job);
+
+// Render view at (xoff, yoff) on a sw x sh screen, centered if it fits
+void tiled_render(JTiledImage *tiled, SDL_Renderer *renderer, int xoff, int yoff, int sw, int sh);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
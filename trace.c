@@ -0,0 +1,233 @@
+/**
+ * Chrome trace event recording of image loading and drawing stages.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+typedef struct JTraceChunk {
+    struct JTraceChunk *next;
+    int count;
+    JTraceEvent events[TRACE_CHUNK];
+} JTraceChunk;
+
+typedef struct JTraceThread {
+    int id; // small number in order of first span
+    const char *name;
+    const JPEGRecord *jpeg; // current entry
+    int w, h;
+    JTraceChunk *first, *last;
+    int chunks, dropped;
+    struct JTraceThread *next;
+} JTraceThread;
+
+static char *tracePath = NULL;
+static SDL_TLSID traceKey = 0;
+static SDL_mutex *traceLock = NULL; // for the list of threads
+static JTraceThread *threads = NULL;
+static int threadCount = 0;
+static Uint64 traceStart;
+
+int init_trace(const char *path) {
+    if((traceKey = SDL_TLSCreate()) == 0 ||
+            (traceLock = SDL_CreateMutex()) == NULL ||
+            (tracePath = strdup(path)) == NULL) {
+        if(traceLock != NULL)
+            SDL_DestroyMutex(traceLock);
+        traceLock = NULL;
+        traceKey = 0;
+        return 0;
+    }
+
+    traceStart = SDL_GetPerformanceCounter();
+
+    return 1;
+}
+
+// Calling thread's buffer, created on first use
+static JTraceThread *getThread(void) {
+    JTraceThread *thread;
+
+    if((thread = (JTraceThread *)SDL_TLSGet(traceKey)) != NULL)
+        return thread;
+
+    if((thread = (JTraceThread *)calloc(1, sizeof(JTraceThread))) == NULL)
+        return NULL;
+
+    SDL_LockMutex(traceLock);
+    thread->id = ++threadCount;
+    thread->next = threads;
+    threads = thread;
+    SDL_UnlockMutex(traceLock);
+
+    SDL_TLSSet(traceKey, thread, NULL); // freed by quit_trace()
+
+    return thread;
+}
+
+void trace_thread(const char *name) {
+    JTraceThread *thread;
+
+    if(traceKey && (thread = getThread()) != NULL)
+        thread->name = name;
+}
+
+void trace_entry(const JPEGRecord *jpeg, int w, int h) {
+    JTraceThread *thread;
+
+    if(!traceKey || (thread = getThread()) == NULL)
+        return;
+
+    thread->jpeg = jpeg;
+    thread->w = w;
+    thread->h = h;
+}
+
+Uint64 trace_start(void) {
+    return traceKey ? SDL_GetPerformanceCounter() : 0;
+}
+
+void trace_end(const char *name, Uint64 start) {
+    JTraceThread *thread;
+    JTraceChunk *chunk;
+    JTraceEvent *event;
+
+    if(!start || (thread = getThread()) == NULL)
+        return;
+
+    if((chunk = thread->last) == NULL || chunk->count == TRACE_CHUNK) {
+        if(thread->chunks < TRACE_MAX_CHUNKS &&
+                (chunk = (JTraceChunk *)malloc(sizeof(JTraceChunk))) != NULL)
+            thread->chunks++;
+        else if((chunk = thread->first) != NULL && chunk->next != NULL) { // reuse oldest
+            thread->first = chunk->next;
+            thread->dropped += chunk->count;
+        } else { // not even one, or it's the one that's full
+            thread->dropped++;
+            return;
+        }
+        chunk->next = NULL;
+        chunk->count = 0;
+        if(thread->last != NULL)
+            thread->last->next = chunk;
+        else
+            thread->first = chunk;
+        thread->last = chunk;
+    }
+
+    event = &chunk->events[chunk->count++];
+    event->name = name;
+    event->start = start;
+    event->end = SDL_GetPerformanceCounter();
+    event->jpeg = thread->jpeg;
+    event->w = thread->w;
+    event->h = thread->h;
+}
+
+static void writeString(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if((unsigned char)*s < 32)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static double toUs(Uint64 ticks) {
+    return ticks * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void writeEvent(FILE *fp, JTraceThread *thread, JTraceEvent *event, JCatalog *catalog) {
+    JArchive *archive;
+
+    fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"jzipview\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d,"
+            " \"ts\": %.3f, \"dur\": %.3f", event->name, thread->id,
+            toUs(event->start - traceStart), toUs(event->end - event->start));
+
+    if(event->jpeg != NULL && catalog != NULL) {
+        archive = &catalog->archives[event->jpeg->archive];
+        fprintf(fp, ", \"args\": {\"index\": %d, \"w\": %d, \"h\": %d",
+                archive->first + (int)(event->jpeg - archive->index->jpegs), event->w, event->h);
+        if(zipindex_done(archive->index)) { // names are there
+            fputs(", \"file\": ", fp);
+            writeString(fp, zipindex_name(archive->index, (JPEGRecord *)event->jpeg));
+        }
+        fputc('}', fp);
+    }
+
+    fputc('}', fp);
+}
+
+void quit_trace(JCatalog *catalog) {
+    JTraceThread *thread;
+    JTraceChunk *chunk, *next;
+    FILE *fp;
+    int dropped = 0, i;
+
+    if(!traceKey)
+        return;
+
+    if((fp = fopen(tracePath, "w")) == NULL)
+        fprintf(stderr, "Couldn't write trace to %s\n", tracePath);
+    else // metadata first, so there's no comma to worry about
+        fprintf(fp, "{\"traceEvents\": [\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1,"
+                " \"args\": {\"name\": \"jzipview\"}}");
+
+    while((thread = threads) != NULL) {
+        if(fp != NULL) {
+            fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d,"
+                    " \"args\": {\"name\": ", thread->id);
+            writeString(fp, thread->name ? thread->name : "thread");
+            fputs("}}", fp);
+            for(chunk = thread->first; chunk != NULL; chunk = chunk->next)
+                for(i = 0; i < chunk->count; i++)
+                    writeEvent(fp, thread, &chunk->events[i], catalog);
+            if(thread->dropped)
+                fprintf(stderr, "Trace buffer of thread %d full, %d oldest spans dropped\n",
+                        thread->id, thread->dropped);
+            dropped += thread->dropped;
+        }
+
+        for(chunk = thread->first; chunk != NULL; chunk = next) {
+            next = chunk->next;
+            free(chunk);
+        }
+        threads = thread->next;
+        free(thread);
+    }
+
+    if(fp != NULL) {
+        fprintf(fp, "\n],\n\"otherData\": {\"droppedEvents\": %d}}\n", dropped);
+        fclose(fp);
+    }
+
+    SDL_DestroyMutex(traceLock);
+    traceLock = NULL;
+    traceKey = 0;
+    free(tracePath);
+    tracePath = NULL;
+}
@@ -0,0 +1,81 @@
+/**
+ * Chrome trace event recording of image loading and drawing stages.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "SDL2/SDL.h"
+
+#include "catalog.h"
+#include "loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Spans of every loading and drawing stage, written at exit as a Chrome /
+ * Perfetto trace event file. Each thread appends to its own buffer found
+ * through thread local storage, so recording takes no locks except when a
+ * thread records its first span. Spans are tagged with the entry the
+ * thread is working on, see trace_entry(). When tracing is off,
+ * trace_start() returns 0 and trace_end() does nothing.
+ *
+ * A thread's buffer is a ring of at most TRACE_MAX_CHUNKS chunks. When it's
+ * full the oldest chunk is reused, so a long session keeps its latest spans
+ * and the file tells how many older ones were dropped.
+ */
+
+#define TRACE_CHUNK 4096 // events per allocation
+#define TRACE_MAX_CHUNKS 256 // per thread, oldest spans are dropped after that
+
+typedef struct {
+    const char *name; // static string
+    Uint64 start, end; // SDL_GetPerformanceCounter()
+    const JPEGRecord *jpeg; // NULL if not for an entry
+    int w, h; // target size
+} JTraceEvent;
+
+// Start recording, spans are written to path by quit_trace(). Call before
+// other threads start. Returns 0 if tracing can't be set up.
+int init_trace(const char *path);
+
+// Write spans with entry indexes and names from catalog (may be NULL) and
+// free them. Call after other threads are done.
+void quit_trace(JCatalog *catalog);
+
+// Name shown for calling thread
+void trace_thread(const char *name);
+
+// Entry and target size the calling thread's spans are about, NULL to clear
+void trace_entry(const JPEGRecord *jpeg, int w, int h);
+
+// Nonzero timestamp if tracing
+Uint64 trace_start(void);
+
+// Record span from start to now unless start is 0
+void trace_end(const char *name, Uint64 start);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif
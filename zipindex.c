@@ -0,0 +1,523 @@
+/**
+ * Compact index of archive entries with an optional sidecar file.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#if defined _WIN32 || defined _WIN64
+#include "windows.h"
+#else
+#include <sys/mman.h>
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "zipindex.h"
+#include "mapfile.h"
+#include "thumbcache.h"
+
+#define PUBLISH_EVERY 4096 // entries, and at powers of two before that
+#define DIRECTORY_CHUNK (1 << 20) // central directory is read this much at a time
+#define END_SEARCH (22 + 65535) // end record and longest comment
+
+#define CENTRAL_SIGNATURE 0x02014B50
+#define END_SIGNATURE 0x06054B50
+#define END64_SIGNATURE 0x06064B50
+#define LOCATOR64_SIGNATURE 0x07064B50
+
+typedef struct {
+    Uint64 entries, size, offset;
+} JCentralDirectory;
+
+typedef struct {
+    JZipIndex *index;
+    JZFile *zip; // own handle when parsing in background
+    JCentralDirectory directory;
+    unsigned char *buffer; // DIRECTORY_CHUNK of it
+    size_t length, at; // bytes in buffer and parse position
+    Uint64 position; // archive offset of next read
+    int (*filter)(const char *filename);
+    int id; // for JPEGRecord.archive
+    int background;
+    int count; // parsed, index->count is what's published
+    char *names; // moved to index when done
+    Uint32 namesSize, namesMax;
+    int failed; // out of memory
+
+    FILE *sidecar; // records are written as they are parsed, NULL if not wanted
+    JZipIndexHeader header;
+    char path[1024], tmpPath[1040];
+} JIndexBuilder;
+
+// Make parsed entries visible, returns zero if index is being destroyed
+static int publish(JIndexBuilder *builder, int done) {
+    JZipIndex *index = builder->index;
+    int quit;
+
+    SDL_LockMutex(index->lock);
+    index->count = builder->count;
+    if(done) {
+        index->names = builder->names;
+        index->namesSize = builder->namesSize;
+        index->done = 1;
+    }
+    quit = index->quit;
+    SDL_UnlockMutex(index->lock);
+
+    return !quit;
+}
+
+static Uint16 le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static Uint32 le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (Uint32)p[3] << 24;
+}
+
+static Uint64 le64(const unsigned char *p) {
+    return le32(p) | (Uint64)le32(p + 4) << 32;
+}
+
+// Find central directory from end record, or ZIP64 end record if there's
+// one. Returns zero for broken and multi-disk archives.
+static int findDirectory(JZFile *zip, JCentralDirectory *directory) {
+    Uint64 size = jzfile_size(zip), start;
+    unsigned char *tail, *end, end64[56];
+    size_t n;
+    int ok = 0;
+
+    if(size < 22)
+        return 0;
+
+    n = (size_t)MIN(size, END_SEARCH);
+    start = size - n;
+    if((tail = (unsigned char *)malloc(n)) == NULL || jzfile_read_at(zip, start, tail, n) != n) {
+        free(tail);
+        return 0;
+    }
+
+    for(end = tail + n - 22; end >= tail && le32(end) != END_SIGNATURE; end--)
+        ;
+
+    if(end >= tail) {
+        directory->entries = le16(end + 10);
+        directory->size = le32(end + 12);
+        directory->offset = le32(end + 16);
+        ok = !le16(end + 4) && !le16(end + 6);
+
+        // Locator right before the end record points to the ZIP64 one
+        if(end - tail >= 20 && le32(end - 20) == LOCATOR64_SIGNATURE) {
+            ok = jzfile_read_at(zip, le64(end - 20 + 8), end64, 56) == 56 &&
+                le32(end64) == END64_SIGNATURE && !le32(end64 + 16) && !le32(end64 + 20);
+            directory->entries = le64(end64 + 32);
+            directory->size = le64(end64 + 40);
+            directory->offset = le64(end64 + 48);
+        }
+    }
+
+    free(tail);
+
+    return ok && directory->offset + directory->size <= size &&
+        directory->entries <= directory->size / 46; // smallest header
+}
+
+// At least need bytes at builder->at, reads more of directory if not
+static int fill(JIndexBuilder *builder, size_t need) {
+    JCentralDirectory *directory = &builder->directory;
+    size_t n;
+
+    if(builder->length - builder->at >= need)
+        return 1;
+
+    memmove(builder->buffer, builder->buffer + builder->at, builder->length - builder->at);
+    builder->length -= builder->at;
+    builder->at = 0;
+
+    n = (size_t)MIN(DIRECTORY_CHUNK - builder->length, directory->offset + directory->size - builder->position);
+    if(jzfile_read_at(builder->zip, builder->position, builder->buffer + builder->length, n) != n)
+        return 0;
+
+    builder->position += n;
+    builder->length += n;
+
+    return builder->length >= need;
+}
+
+// Sizes and offset of 0xFFFFFFFF are in ZIP64 extended information field
+static void readZip64(JPEGRecord *jpeg, const unsigned char *extra, int length) {
+    const unsigned char *field, *end;
+    int id, size;
+
+    for(; length >= 4; extra += 4 + size, length -= 4 + size) {
+        id = le16(extra);
+        size = MIN(le16(extra + 2), length - 4);
+        if(id != 0x0001)
+            continue;
+
+        field = extra + 4; // only the ones overflowing are there, in this order
+        end = field + size;
+        if(jpeg->size == 0xFFFFFFFF && field + 8 <= end) {
+            jpeg->size = (Sint64)le64(field);
+            field += 8;
+        }
+        if(jpeg->compressedSize == 0xFFFFFFFF && field + 8 <= end) {
+            jpeg->compressedSize = (Sint64)le64(field);
+            field += 8;
+        }
+        if(jpeg->offset == 0xFFFFFFFF && field + 8 <= end)
+            jpeg->offset = (Sint64)le64(field);
+        return;
+    }
+}
+
+// Store central directory header at p if filter wants it, returns zero if
+// parsing should stop
+static int addRecord(JIndexBuilder *builder, const unsigned char *p) {
+    JPEGRecord *jpeg;
+    int len = le16(p + 28);
+    char *names;
+
+    if(builder->namesSize + len + 1 > builder->namesMax) { // names go in one arena
+        builder->namesMax = (builder->namesSize + len + 1) * 2;
+        if((names = (char *)realloc(builder->names, builder->namesMax)) == NULL) {
+            builder->failed = 1;
+            return 0;
+        }
+        builder->names = names;
+    }
+
+    memcpy(builder->names + builder->namesSize, p + 46, len);
+    builder->names[builder->namesSize + len] = '\0';
+
+    if(!builder->filter(builder->names + builder->namesSize))
+        return 1; // skip
+
+    // Slots past published count are ours, main thread doesn't look there
+    jpeg = &builder->index->jpegs[builder->count++];
+    jpeg->offset = le32(p + 42);
+    jpeg->size = le32(p + 24);
+    jpeg->compressedSize = le32(p + 20);
+    jpeg->method = le16(p + 10);
+    jpeg->crc = le32(p + 16);
+    jpeg->name = builder->namesSize;
+    jpeg->nameLength = (Uint16)len;
+    jpeg->archive = (Uint16)builder->id;
+    readZip64(jpeg, p + 46 + len, le16(p + 30));
+
+    builder->namesSize += len + 1;
+
+    // Written before main thread can set failed or queued flags
+    if(builder->sidecar != NULL && fwrite(jpeg, sizeof(JPEGRecord), 1, builder->sidecar) != 1) {
+        fclose(builder->sidecar);
+        remove(builder->tmpPath);
+        builder->sidecar = NULL;
+    }
+
+    // First screenful right away, then in growing batches
+    if((builder->count & (builder->count - 1)) == 0 || builder->count % PUBLISH_EVERY == 0)
+        return publish(builder, 0);
+
+    return 1;
+}
+
+// Walk central directory in big reads, returns zero on errors
+static int readDirectory(JIndexBuilder *builder) {
+    const unsigned char *p;
+    Uint64 i;
+    size_t size;
+
+    if((builder->buffer = (unsigned char *)malloc(DIRECTORY_CHUNK)) == NULL)
+        return 0;
+
+    builder->position = builder->directory.offset;
+
+    for(i = 0; i < builder->directory.entries; i++) {
+        if(!fill(builder, 46) || le32(builder->buffer + builder->at) != CENTRAL_SIGNATURE)
+            return 0;
+
+        p = builder->buffer + builder->at;
+        size = 46 + le16(p + 28) + le16(p + 30) + le16(p + 32); // name, extra, comment
+        if(!fill(builder, size))
+            return 0;
+
+        if(!addRecord(builder, builder->buffer + builder->at))
+            return 0;
+        builder->at += size;
+    }
+
+    return 1;
+}
+
+static void unmapSidecar(JZipIndex *index) {
+#if defined _WIN32 || defined _WIN64
+    free(index->map);
+#else
+    munmap(index->map, index->mapSize);
+#endif
+    index->map = NULL;
+}
+
+// Map sidecar file if it was made from this very archive
+static int mapSidecar(JZipIndex *index, const char *path, JZipIndexHeader *expect, int id) {
+    JZipIndexHeader *header;
+    struct stat st;
+    FILE *fp;
+    Uint32 i;
+
+    if((fp = fopen(path, "rb")) == NULL)
+        return 0;
+
+    if(fstat(fileno(fp), &st) || st.st_size < (long)sizeof(JZipIndexHeader)) {
+        fclose(fp);
+        return 0;
+    }
+
+    index->mapSize = st.st_size;
+#if defined _WIN32 || defined _WIN64
+    if((index->map = (unsigned char *)malloc(index->mapSize)) != NULL &&
+            fread(index->map, 1, index->mapSize, fp) != index->mapSize) {
+        free(index->map);
+        index->map = NULL;
+    }
+#else
+    // Private and writable, so failed and queued flags can be updated
+    index->map = (unsigned char *)mmap(NULL, index->mapSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, fileno(fp), 0);
+    if(index->map == MAP_FAILED)
+        index->map = NULL;
+#endif
+    fclose(fp);
+
+    if(index->map == NULL)
+        return 0;
+
+    header = (JZipIndexHeader *)index->map;
+
+    if(memcmp(header, expect, offsetof(JZipIndexHeader, count)) ||
+            sizeof(JZipIndexHeader) + (Uint64)header->count * sizeof(JPEGRecord) +
+            header->namesSize != index->mapSize ||
+            (header->namesSize && index->map[index->mapSize - 1] != '\0')) {
+        unmapSidecar(index); // stale, rewritten after parsing
+        return 0;
+    }
+
+    index->jpegs = (JPEGRecord *)(index->map + sizeof(JZipIndexHeader));
+    index->count = header->count;
+    index->names = (char *)(index->jpegs + header->count);
+    index->namesSize = header->namesSize;
+    index->done = 1;
+
+    // Archive id may differ from last time, only touch pages if it does
+    for(i = 0; i < header->count; i++)
+        if(index->jpegs[i].archive != id)
+            index->jpegs[i].archive = (Uint16)id;
+
+    return 1;
+}
+
+// Header is written last, so a partial file never passes as valid
+static void finishSidecar(JIndexBuilder *builder, int ok) {
+    FILE *fp = builder->sidecar;
+
+    if(fp == NULL)
+        return;
+
+    builder->header.count = builder->count;
+    builder->header.namesSize = builder->namesSize;
+
+    ok = ok && fwrite(builder->names, 1, builder->namesSize, fp) == builder->namesSize &&
+        !fseek(fp, 0, SEEK_SET) && fwrite(&builder->header, sizeof(JZipIndexHeader), 1, fp) == 1;
+
+    if(fclose(fp) || !ok) {
+        remove(builder->tmpPath);
+        return;
+    }
+
+    remove(builder->path); // rename() won't replace on Windows
+    rename(builder->tmpPath, builder->path);
+}
+
+// Returns zero if central directory couldn't be read
+static int parse(JIndexBuilder *builder) {
+    JZipIndex *index = builder->index;
+    int ok = readDirectory(builder) && !builder->failed;
+    void *shrunk;
+
+    free(builder->buffer);
+
+    SDL_LockMutex(index->lock);
+    ok = ok && !index->quit;
+    SDL_UnlockMutex(index->lock);
+
+    finishSidecar(builder, ok);
+
+    // Non-JPEG entries were skipped and arena has grown in doubling steps.
+    // Records can't move once main thread may have seen them.
+    if(!builder->background &&
+            (shrunk = realloc(index->jpegs, (builder->count + 1) * sizeof(JPEGRecord))) != NULL)
+        index->jpegs = (JPEGRecord *)shrunk;
+    if(builder->namesSize && (shrunk = realloc(builder->names, builder->namesSize)) != NULL)
+        builder->names = (char *)shrunk;
+
+    publish(builder, 1);
+
+    return ok;
+}
+
+static int parseThread(void *data) {
+    JIndexBuilder *builder = (JIndexBuilder *)data;
+
+    parse(builder); // what was read before an error stays
+    builder->zip->close(builder->zip);
+    free(builder);
+
+    return 0;
+}
+
+JZipIndex *create_zipindex(JZFile *zip, const char *archive, int id, int options,
+        int (*filter)(const char *filename)) {
+    JZipIndex *index = (JZipIndex *)calloc(1, sizeof(JZipIndex));
+    JIndexBuilder *builder = (JIndexBuilder *)calloc(1, sizeof(JIndexBuilder));
+    JZipIndexHeader *header = &builder->header;
+    struct stat st;
+    int ok;
+
+    if(index == NULL || builder == NULL || (index->lock = SDL_CreateMutex()) == NULL ||
+            !findDirectory(zip, &builder->directory)) {
+        free(builder);
+        if(index != NULL)
+            destroy_zipindex(index);
+        return NULL;
+    }
+
+    builder->index = index;
+    builder->zip = zip;
+    builder->filter = filter;
+    builder->id = id;
+
+    if((options & ZIPINDEX_SIDECAR) && !stat(archive, &st) &&
+            thumbcache_file(archive, ".jzi", builder->path, sizeof(builder->path))) {
+        memcpy(header->magic, ZIPINDEX_MAGIC, 4);
+        header->version = ZIPINDEX_VERSION;
+        header->archiveSize = st.st_size;
+        header->archiveTime = st.st_mtime;
+        header->numEntries = builder->directory.entries;
+        header->centralDirectorySize = builder->directory.size;
+        header->centralDirectoryOffset = builder->directory.offset;
+        header->recordSize = sizeof(JPEGRecord);
+
+        if(mapSidecar(index, builder->path, header, id)) {
+            free(builder);
+            return index;
+        }
+
+        // Placeholder header now, the real one when all records are in
+        snprintf(builder->tmpPath, sizeof(builder->tmpPath), "%s.tmp", builder->path);
+        if(builder->directory.entries >= ZIPINDEX_MIN_ENTRIES &&
+                (builder->sidecar = fopen(builder->tmpPath, "wb")) != NULL &&
+                fwrite(header, sizeof(JZipIndexHeader), 1, builder->sidecar) != 1) {
+            fclose(builder->sidecar);
+            remove(builder->tmpPath);
+            builder->sidecar = NULL;
+        }
+    }
+
+    // Room for all entries, so records never move. Padding is zeroed too,
+    // records are written to sidecar as they are.
+    if((index->jpegs = (JPEGRecord *)calloc((size_t)builder->directory.entries + 1, sizeof(JPEGRecord))) == NULL) {
+        finishSidecar(builder, 0);
+        free(builder);
+        destroy_zipindex(index);
+        return NULL;
+    }
+
+    // Own handle for the parsing thread, loader uses the other one meanwhile.
+    // Small archives are quicker to parse than to start a thread for.
+    if((options & ZIPINDEX_BACKGROUND) && builder->directory.entries >= ZIPINDEX_MIN_ENTRIES &&
+            (builder->zip = jzfile_open(archive)) != NULL) {
+        builder->background = 1;
+        if((index->thread = SDL_CreateThread(parseThread, "index", builder)) != NULL)
+            return index;
+        builder->zip->close(builder->zip);
+        builder->zip = zip;
+        builder->background = 0;
+    }
+
+    ok = parse(builder);
+    free(builder);
+
+    if(!ok) {
+        destroy_zipindex(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void destroy_zipindex(JZipIndex *index) {
+    if(index->thread != NULL) {
+        SDL_LockMutex(index->lock);
+        index->quit = 1;
+        SDL_UnlockMutex(index->lock);
+        SDL_WaitThread(index->thread, NULL);
+    }
+
+    if(index->map != NULL)
+        unmapSidecar(index);
+    else {
+        free(index->jpegs);
+        free(index->names);
+    }
+
+    if(index->lock != NULL)
+        SDL_DestroyMutex(index->lock);
+    free(index);
+}
+
+int zipindex_count(JZipIndex *index) {
+    int count;
+
+    SDL_LockMutex(index->lock);
+    count = index->count;
+    SDL_UnlockMutex(index->lock);
+
+    return count;
+}
+
+int zipindex_done(JZipIndex *index) {
+    int done;
+
+    SDL_LockMutex(index->lock);
+    done = index->done;
+    SDL_UnlockMutex(index->lock);
+
+    return done;
+}
+
+const char *zipindex_name(JZipIndex *index, JPEGRecord *jpeg) {
+    return index->names + jpeg->name;
+}
+
+size_t zipindex_bytes(JZipIndex *index) {
+    return sizeof(JZipIndex) + index->count * sizeof(JPEGRecord) + index->namesSize;
+}
@@ -0,0 +1,107 @@
+/**
+ * Compact index of archive entries with an optional sidecar file.
+ *
+ * Copyright 2013 by Joonas Pihlajamaa <joonas.pihlajamaa@iki.fi>
+ *
+ * This file is part of JZipView, see https://github.com/jokkebk/JZipVIew
+ *
+ * JZipView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JZipView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JZipView.  If not, see <http://www.gnu.org/licenses/>.
+ * @license GPL-3.0+ <http://spdx.org/licenses/GPL-3.0+>
+ */
+#ifndef __ZIPINDEX_H
+#define __ZIPINDEX_H
+
+#include "SDL2/SDL.h"
+
+#include "junzip.h"
+#include "loader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+ * Entries are one JPEGRecord array plus one arena of NUL terminated
+ * filenames, no allocations per entry. Huge archives also get a sidecar
+ * file next to the thumbnail cache with the same layout: header, records
+ * and names. When the header still matches the archive and its end of
+ * central directory record, the sidecar is mapped and used as is instead
+ * of parsing the central directory again.
+ *
+ * Parsing can also run in a thread with its own archive handle. Records go
+ * to an array with room for every entry, so they never move, and
+ * zipindex_count() tells how many are in so far.
+ */
+
+#define ZIPINDEX_MAGIC "JZIX"
+#define ZIPINDEX_VERSION 2
+#define ZIPINDEX_MIN_ENTRIES 10000 // smaller ones parse in a few ms anyway
+
+#define ZIPINDEX_SIDECAR 1 // use and write sidecar file
+#define ZIPINDEX_BACKGROUND 2 // return right away, parse big ones in a thread
+
+typedef struct {
+    char magic[4];
+    Uint32 version;
+    Uint64 archiveSize;
+    Sint64 archiveTime;
+    Uint64 numEntries; // from (ZIP64) end of central directory record
+    Uint64 centralDirectorySize;
+    Uint64 centralDirectoryOffset;
+    Uint32 recordSize; // sizeof(JPEGRecord), differs between builds
+    Uint32 count;
+    Uint32 namesSize;
+    Uint32 reserved;
+} JZipIndexHeader;
+
+typedef struct {
+    JPEGRecord *jpegs;
+    int count; // use zipindex_count() while parsing
+    char *names; // JPEGRecord.name is an offset here, set when done
+    Uint32 namesSize;
+
+    unsigned char *map; // sidecar file, jpegs and names are in it if not NULL
+    size_t mapSize;
+
+    SDL_Thread *thread; // background parsing
+    SDL_mutex *lock; // for count, names and flags below
+    int done, quit;
+} JZipIndex;
+
+// Index entries accepted by filter, records get id as their archive.
+// Options need archive path. Returns NULL if end record, or central
+// directory when not in background, can't be read.
+JZipIndex *create_zipindex(JZFile *zip, const char *archive, int id, int options,
+        int (*filter)(const char *filename));
+
+// Stops background parsing
+void destroy_zipindex(JZipIndex *index);
+
+// Entries in jpegs so far
+int zipindex_count(JZipIndex *index);
+
+// Whole central directory has been parsed (or read failed midway)
+int zipindex_done(JZipIndex *index);
+
+// Only once zipindex_done()
+const char *zipindex_name(JZipIndex *index, JPEGRecord *jpeg);
+
+// Memory used by records and names, once zipindex_done()
+size_t zipindex_bytes(JZipIndex *index);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif